@@ -2,8 +2,11 @@
 
 #include "mcf_fasta_sequence.hh"
 
+#include <limits.h>  // UCHAR_MAX
 #include <stddef.h>
+#include <string.h>  // memchr
 
+#include <algorithm>  // copy, min
 //#include <iostream>  // for debugging
 #include <istream>
 #include <ostream>
@@ -72,8 +75,125 @@ static void writeOneLine(std::ostream &s, const std::vector<uchar> &v) {
   b->sputc('\n');
 }
 
+// Reads more input into the buffer, after the unused input, and
+// returns false if there is no more
+bool FastaReader::fill() {
+  const size_t minReadSize = 1 << 20;
+  if (!stream) return false;
+  if (beg > 0) {
+    std::copy(buffer.begin() + beg, buffer.begin() + end, buffer.begin());
+    offsetOfData += beg;
+    end -= beg;
+    beg = 0;
+  }
+  if (buffer.size() < end + minReadSize) buffer.resize(end + minReadSize);
+  data = &buffer[0];
+  stream->read(&buffer[end], buffer.size() - end);
+  size_t n = stream->gcount();
+  end += n;
+  return n > 0;
+}
+
+// Returns false if there is nothing but spaces
+bool FastaReader::skipSpaces() {
+  for (;;) {
+    while (beg < end && uchar(data[beg]) <= ' ') ++beg;
+    if (beg < end) return true;
+    if (!fill()) return false;
+  }
+}
+
+void FastaReader::readLine(std::string &line) {
+  line.clear();
+  for (;;) {
+    const char *b = data + beg;
+    const char *e = data + end;
+    const char *n = static_cast<const char *>(memchr(b, '\n', e - b));
+    line.append(b, n ? n : e);
+    beg = n ? n + 1 - data : end;
+    if (n || !fill()) return;
+  }
+}
+
+// Appends the non-space characters in [beg, end)
+static void appendNonSpaces(std::vector<uchar> &v,
+			      const char *beg, const char *end) {
+  uchar minChar = UCHAR_MAX;
+  for (const char *i = beg; i < end; ++i)  // vectorizable
+    minChar = std::min(minChar, uchar(*i));
+  if (minChar > ' ') {
+    v.insert(v.end(), beg, end);
+  } else {
+    for (const char *i = beg; i < end; ++i)
+      if (uchar(*i) > ' ') v.push_back(*i);
+  }
+}
+
+// Appends non-space characters, one line at a time, until the
+// delimiter or the end of input
+void FastaReader::readLetters(std::vector<uchar> &letters, char delimiter) {
+  for (;;) {
+    const char *b = data + beg;
+    const char *e = data + end;
+    const char *d = static_cast<const char *>(memchr(b, delimiter, e - b));
+    const char *stop = d ? d : e;
+    while (b < stop) {
+      const char *n = static_cast<const char *>(memchr(b, '\n', stop - b));
+      const char *lineEnd = n ? n : stop;
+      appendNonSpaces(letters, b, lineEnd);
+      b = n ? n + 1 : stop;
+    }
+    beg = stop - data;
+    if (d || !fill()) return;
+  }
+}
+
+// Appends count non-space characters, or fewer at the end of input
+void FastaReader::readLetterCount(std::vector<uchar> &letters,
+				  size_t count) {
+  size_t target = letters.size() + count;
+  while (letters.size() < target && skipSpaces()) {
+    const char *b = data + beg;
+    const char *e = data + end;
+    const char *n = static_cast<const char *>(memchr(b, '\n', e - b));
+    const char *lineEnd = n ? n : e;
+    size_t todo = target - letters.size();
+    if (size_t(lineEnd - b) > todo) lineEnd = b + todo;
+    appendNonSpaces(letters, b, lineEnd);
+    beg = lineEnd - data;
+  }
+}
+
+bool FastaReader::read(FastaSequence &f) {
+  if (!skipSpaces()) return false;
+  char firstChar = data[beg];
+  if (firstChar != '>' && firstChar != '@') return false;
+  ++beg;
+
+  f.sequence.clear();
+  f.secondTitle.clear();
+  f.qualityCodes.clear();
+
+  readLine(f.title);
+
+  if (firstChar == '>') {
+    readLetters(f.sequence, '>');
+  } else {
+    readLetters(f.sequence, '+');
+    if (skipSpaces()) {
+      ++beg;
+      readLine(f.secondTitle);
+      readLetterCount(f.qualityCodes, f.sequence.size());
+    }
+  }
+
+  return true;
+}
+
+static const size_t fastaLineLength = 50;  // ?
+
 static void writeMultiLines(std::ostream &s, const std::vector<uchar> &v) {
-  size_t lettersPerLine = 50;  // ?
+  size_t lettersPerLine = fastaLineLength;
   std::streambuf *b = s.rdbuf();
   size_t size = v.size();
   for (size_t i = 0; i < size; i += lettersPerLine) {
@@ -83,6 +203,43 @@ static void writeMultiLines(std::ostream &s, const std::vector<uchar> &v) {
   }
 }
 
+std::istream &readFastaTitle(std::istream &s, std::string &title) {
+  char firstChar = '>';
+  s >> firstChar;
+  if (firstChar != '>') s.setstate(std::ios::failbit);
+  if (!s) return s;
+  return getline(s, title);
+}
+
+bool readFastaLetters(std::istream &s, std::vector<uchar> &sequence,
+		      size_t maxSize) {
+  std::streambuf *b = s.rdbuf();
+  int c = b->sgetc();
+  while (sequence.size() < maxSize) {
+    if (c == std::streambuf::traits_type::eof() || c == '>') return false;
+    if (c > ' ') sequence.push_back(c);
+    c = b->snextc();
+  }
+  return true;
+}
+
+void writeFastaLetters(std::ostream &s, const uchar *beg, const uchar *end,
+		       size_t position) {
+  std::streambuf *b = s.rdbuf();
+  while (beg < end) {
+    size_t n = fastaLineLength - position % fastaLineLength;
+    if (n > size_t(end - beg)) n = end - beg;
+    b->sputn(reinterpret_cast<const char *>(beg), n);
+    beg += n;
+    position += n;
+    if (position % fastaLineLength == 0) b->sputc('\n');
+  }
+}
+
+void endFastaLetters(std::ostream &s, size_t length) {
+  if (length % fastaLineLength) s.rdbuf()->sputc('\n');
+}
+
 std::ostream &operator<<(std::ostream &s, const FastaSequence &f) {
   if (f.qualityCodes.empty()) {
     s << '>' << f.title << '\n';
@@ -3,6 +3,8 @@
 #ifndef MCF_FASTA_SEQUENCE_HH
 #define MCF_FASTA_SEQUENCE_HH
 
+#include <stddef.h>  // size_t
+
 #include <iosfwd>
 #include <string>
 #include <vector>
@@ -22,8 +24,64 @@ struct FastaSequence {
 
 std::istream &operator>>(std::istream &s, FastaSequence &f);
 
+// This reads fasta or fastq sequences like operator>>, but faster: it
+// reads the input in big blocks, finds line ends and '>' with memchr,
+// and copies whole lines at once.  It keeps any input it has read
+// beyond the sequence, so the stream shouldn't be read other ways.
+class FastaReader {
+public:
+  explicit FastaReader(std::istream &s)
+    : stream(&s), data(0), beg(0), end(0), offsetOfData(0) {}
+
+  // Reads from memory (e.g. a mapped file) instead of a stream
+  FastaReader(const char *inputBeg, const char *inputEnd)
+    : stream(0), data(inputBeg), beg(0), end(inputEnd - inputBeg),
+      offsetOfData(0) {}
+
+  // Returns false if there are no more sequences.  It re-uses f's
+  // memory.
+  bool read(FastaSequence &f);
+
+  // The number of input bytes used so far.  After read returns false,
+  // this includes any spaces at the end of the input.
+  size_t offset() const { return offsetOfData + beg; }
+
+private:
+  std::istream *stream;  // null if reading from memory
+  std::vector<char> buffer;
+  const char *data;  // the input in buffer or memory
+  size_t beg;  // start of unused input in data
+  size_t end;  // end of unused input in data
+  size_t offsetOfData;
+
+  bool fill();
+  bool skipSpaces();
+  void readLine(std::string &line);
+  void readLetters(std::vector<uchar> &letters, char delimiter);
+  void readLetterCount(std::vector<uchar> &letters, size_t count);
+};
+
 std::ostream &operator<<(std::ostream &s, const FastaSequence &f);
 
+// These read and write a fasta (not fastq) sequence bit by bit,
+// without holding it all in memory.
+
+// Reads the '>' and title line
+std::istream &readFastaTitle(std::istream &s, std::string &title);
+
+// Appends letters to "sequence" until its size is maxSize, and
+// returns false if the sequence ends first
+bool readFastaLetters(std::istream &s, std::vector<uchar> &sequence,
+		      size_t maxSize);
+
+// Writes letters in lines like operator<<, given the number of
+// letters written before them.  After the last ones, call
+// endFastaLetters with the total number of letters.
+void writeFastaLetters(std::ostream &s, const uchar *beg, const uchar *end,
+		       size_t position);
+
+void endFastaLetters(std::ostream &s, size_t length);
+
 }
 
 #endif
@@ -0,0 +1,35 @@
+// Copyright 2026 Martin C. Frith
+
+#include "mcf_mapped_file.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mcf {
+
+bool MappedFile::open(const char *fileName) {
+  close();
+  int fd = ::open(fileName, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat s;
+  if (fstat(fd, &s) == 0 && S_ISREG(s.st_mode) && s.st_size > 0) {
+    void *m = mmap(0, s.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (m != MAP_FAILED) {
+      data = static_cast<char *>(m);
+      size = s.st_size;
+      madvise(m, size, MADV_SEQUENTIAL);
+    }
+  }
+  ::close(fd);
+  return data != 0;
+}
+
+void MappedFile::close() {
+  if (data) munmap(data, size);
+  data = 0;
+  size = 0;
+}
+
+}
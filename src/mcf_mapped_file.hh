@@ -0,0 +1,38 @@
+// Copyright 2026 Martin C. Frith
+
+// mcf::MappedFile maps a whole file into memory, privately: the
+// memory can be changed, but the changes are copy-on-write, so they
+// never reach the file, and only the changed pages get copied.
+
+#ifndef MCF_MAPPED_FILE_HH
+#define MCF_MAPPED_FILE_HH
+
+#include <stddef.h>  // size_t
+
+namespace mcf {
+
+class MappedFile {
+public:
+  MappedFile() : data(0), size(0) {}
+  ~MappedFile() { close(); }
+
+  // Returns false if the file can't be mapped, e.g. it is a pipe or
+  // it is empty
+  bool open(const char *fileName);
+
+  void close();
+
+  char *begin() const { return data; }
+  char *end() const { return data + size; }
+
+private:
+  char *data;
+  size_t size;
+
+  MappedFile(const MappedFile &);  // forbid copying
+  MappedFile &operator=(const MappedFile &);
+};
+
+}
+
+#endif
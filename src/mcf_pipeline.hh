@@ -0,0 +1,200 @@
+// Copyright 2026 Martin C. Frith
+
+// mcf::Pipeline reads jobs on one thread, processes them on
+// several worker threads, and writes the results in input order on
+// the calling thread.
+
+// read(job) fills a job, and returns false if there is no more input.
+// work(job) processes a job: it is called concurrently for different
+// jobs.  write(job) is called once per job, in the order they were
+// read.
+
+// Optionally, size(job) estimates how long a job will take: then the
+// workers start the biggest job that has been read so far, rather
+// than the first one.  So big jobs start early, and small jobs fill
+// in the gaps at the end, instead of one worker toiling on a big job
+// after the others have finished.
+
+// The jobs are kept in a fixed ring of numOfSlots slots, which are
+// re-used: so read should re-use the job's memory, and the amount of
+// pending input and output is bounded.
+
+// If read, work, or write throws an exception, the other threads are
+// stopped, and the exception is re-thrown to the caller.  An
+// exception thrown by read or work is re-thrown only after all
+// earlier jobs have been written, just like in a serial program.
+
+#ifndef MCF_PIPELINE_HH
+#define MCF_PIPELINE_HH
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mcf {
+
+template <typename Job>
+class Pipeline {
+public:
+  template <typename Reader, typename Worker, typename Writer>
+  void run(int numOfWorkers, int numOfSlots,
+	   Reader read, Worker work, Writer write) {
+    run(numOfWorkers, numOfSlots, read, work, write,
+	[](const Job &) { return size_t(0); });
+  }
+
+  template <typename Reader, typename Worker, typename Writer, typename Sizer>
+  void run(int numOfWorkers, int numOfSlots,
+	   Reader read, Worker work, Writer write, Sizer size) {
+    slots.resize(numOfSlots);
+    readCount = 0;
+    workCount = 0;
+    isEndOfInput = false;
+    isStopping = false;
+    readError = 0;
+
+    std::vector<std::thread> threads;
+    try {
+      threads.push_back(std::thread(&Pipeline::readJobs<Reader, Sizer>,
+				    this, read, size));
+      for (int i = 0; i < numOfWorkers; ++i)
+	threads.push_back(std::thread(&Pipeline::doJobs<Worker>,
+				      this, work));
+      writeJobs(write);
+    } catch (...) {
+      stop();
+      joinAll(threads);
+      throw;
+    }
+    joinAll(threads);
+  }
+
+private:
+  enum State { isEmpty, isRead, isWorking, isDone };
+
+  struct Slot {
+    Job job;
+    State state;
+    size_t number;  // this job's position in the input
+    size_t size;
+    std::exception_ptr error;
+    Slot() : state(isEmpty) {}
+  };
+
+  std::vector<Slot> slots;
+  size_t readCount;  // number of jobs read so far
+  size_t workCount;  // number of jobs taken by workers so far
+  bool isEndOfInput;
+  bool isStopping;
+  std::exception_ptr readError;
+
+  std::mutex mutex;
+  std::condition_variable changed;
+
+  Slot &slot(size_t jobNumber) {
+    return slots[jobNumber % slots.size()];
+  }
+
+  void stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    isStopping = true;
+    changed.notify_all();
+  }
+
+  static void joinAll(std::vector<std::thread> &threads) {
+    for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+  }
+
+  // The read job with the biggest size, and earliest in the input:
+  Slot &biggestReadJob() {
+    Slot *best = 0;
+    for (size_t i = 0; i < slots.size(); ++i) {
+      Slot &s = slots[i];
+      if (s.state != isRead) continue;
+      if (!best || s.size > best->size ||
+	  (s.size == best->size && s.number < best->number)) best = &s;
+    }
+    return *best;
+  }
+
+  template <typename Reader, typename Sizer>
+  void readJobs(Reader read, Sizer size) {
+    for (size_t i = 0; ; ++i) {
+      Slot &s = slot(i);
+      {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (s.state != isEmpty && !isStopping) changed.wait(lock);
+	if (isStopping) return;
+      }
+      bool isJob;
+      try {
+	isJob = read(s.job);
+	if (isJob) s.size = size(s.job);
+      } catch (...) {
+	std::lock_guard<std::mutex> lock(mutex);
+	readError = std::current_exception();
+	isJob = false;
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      if (isJob) {
+	s.error = 0;
+	s.number = i;
+	s.state = isRead;
+	++readCount;
+      } else {
+	isEndOfInput = true;
+      }
+      changed.notify_all();
+      if (!isJob) return;
+    }
+  }
+
+  template <typename Worker>
+  void doJobs(Worker work) {
+    for (;;) {
+      Slot *s;
+      {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (workCount == readCount && !isEndOfInput && !isStopping)
+	  changed.wait(lock);
+	if (isStopping || workCount == readCount) return;
+	s = &biggestReadJob();
+	++workCount;
+	s->state = isWorking;
+      }
+      try {
+	work(s->job);
+      } catch (...) {
+	s->error = std::current_exception();
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      s->state = isDone;
+      changed.notify_all();
+    }
+  }
+
+  template <typename Writer>
+  void writeJobs(Writer write) {
+    for (size_t i = 0; ; ++i) {
+      Slot &s = slot(i);
+      {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (s.state != isDone && !(isEndOfInput && i == readCount))
+	  changed.wait(lock);
+	if (s.state != isDone) break;
+      }
+      if (s.error) std::rethrow_exception(s.error);
+      write(s.job);
+      std::lock_guard<std::mutex> lock(mutex);
+      s.state = isEmpty;
+      changed.notify_all();
+    }
+    if (readError) std::rethrow_exception(readError);
+  }
+};
+
+}
+
+#endif
@@ -5,7 +5,16 @@
 #define MCF_SIMD_HH
 
 #if defined __SSE4_1__
+// GCC 12's avx512fintrin.h makes hundreds of bogus "may be used
+// uninitialized" warnings, from its _mm512_undefined_* functions
+#if defined __GNUC__ && !defined __clang__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
 #include <immintrin.h>
+#if defined __GNUC__ && !defined __clang__
+#pragma GCC diagnostic pop
+#endif
 #elif defined __ARM_NEON
 #include <arm_neon.h>
 #endif
@@ -18,7 +27,6 @@ namespace mcf {
 
 typedef __m256i SimdInt;
 typedef __m256i SimdUint1;
-typedef __m256d SimdDbl;
 
 const int simdBytes = 32;
 
@@ -30,10 +38,6 @@ static inline SimdInt simdZero1() {
   return _mm256_setzero_si256();
 }
 
-static inline SimdDbl simdZeroDbl() {
-  return _mm256_setzero_pd();
-}
-
 static inline SimdInt simdOnes1() {
   return _mm256_set1_epi32(-1);
 }
@@ -46,10 +50,6 @@ static inline SimdInt simdLoad1(const void *p) {
   return _mm256_loadu_si256((const SimdInt *)p);
 }
 
-static inline SimdDbl simdLoadDbl(const double *p) {
-  return _mm256_loadu_pd(p);
-}
-
 static inline void simdStore(void *p, SimdInt x) {
   _mm256_storeu_si256((SimdInt *)p, x);
 }
@@ -58,10 +58,6 @@ static inline void simdStore1(void *p, SimdInt x) {
   _mm256_storeu_si256((SimdInt *)p, x);
 }
 
-static inline void simdStoreDbl(double *p, SimdDbl x) {
-  _mm256_storeu_pd(p, x);
-}
-
 static inline SimdInt simdOr1(SimdInt x, SimdInt y) {
   return _mm256_or_si256(x, y);
 }
@@ -71,7 +67,6 @@ static inline SimdInt simdBlend(SimdInt x, SimdInt y, SimdInt mask) {
 }
 
 const int simdLen = 8;
-const int simdDblLen = 4;
 
 static inline SimdInt simdSet(int i7, int i6, int i5, int i4,
 			      int i3, int i2, int i1, int i0) {
@@ -92,10 +87,6 @@ static inline SimdInt simdSet1(char jF, char jE, char jD, char jC,
 			 i7, i6, i5, i4, i3, i2, i1, i0);
 }
 
-static inline SimdDbl simdSetDbl(double i3, double i2, double i1, double i0) {
-  return _mm256_set_pd(i3, i2, i1, i0);
-}
-
 static inline SimdInt simdFill(int x) {
   return _mm256_set1_epi32(x);
 }
@@ -104,10 +95,6 @@ static inline SimdInt simdFill1(char x) {
   return _mm256_set1_epi8(x);
 }
 
-static inline SimdDbl simdFillDbl(double x) {
-  return _mm256_set1_pd(x);
-}
-
 static inline SimdInt simdGt(SimdInt x, SimdInt y) {
   return _mm256_cmpgt_epi32(x, y);
 }
@@ -128,10 +115,6 @@ static inline SimdInt simdAdds1(SimdInt x, SimdInt y) {
   return _mm256_adds_epu8(x, y);
 }
 
-static inline SimdDbl simdAddDbl(SimdDbl x, SimdDbl y) {
-  return _mm256_add_pd(x, y);
-}
-
 static inline SimdInt simdSub(SimdInt x, SimdInt y) {
   return _mm256_sub_epi32(x, y);
 }
@@ -140,10 +123,6 @@ static inline SimdInt simdSub1(SimdInt x, SimdInt y) {
   return _mm256_sub_epi8(x, y);
 }
 
-static inline SimdDbl simdMulDbl(SimdDbl x, SimdDbl y) {
-  return _mm256_mul_pd(x, y);
-}
-
 static inline SimdInt simdQuadruple1(SimdInt x) {
   return _mm256_slli_epi32(x, 2);
 }
@@ -172,16 +151,405 @@ static inline int simdHorizontalMin1(SimdInt x) {
   return _mm_extract_epi16(z, 0);
 }
 
+static inline SimdInt simdChoose1(SimdInt items, SimdInt choices) {
+  return _mm256_shuffle_epi8(items, choices);
+}
+
+static inline SimdInt simdXor1(SimdInt x, SimdInt y) {
+  return _mm256_xor_si256(x, y);
+}
+
+// Bit i is the top bit of byte i
+static inline int simdHighBits1(SimdInt x) {
+  return _mm256_movemask_epi8(x);
+}
+
+// Puts the 16 bytes at p into each 16-byte part, for simdChoose1
+static inline SimdInt simdFill16x1(const unsigned char *p) {
+  return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)p));
+}
+
+// 16-bit signed integers, with saturating addition
+
+typedef __m256i SimdInt2;
+
+const int simdLen2 = 16;
+
+static inline SimdInt2 simdLoad2(const short *p) {
+  return _mm256_loadu_si256((const SimdInt2 *)p);
+}
+
+static inline void simdStore2(short *p, SimdInt2 x) {
+  _mm256_storeu_si256((SimdInt2 *)p, x);
+}
+
+static inline SimdInt2 simdFill2(short x) {
+  return _mm256_set1_epi16(x);
+}
+
+static inline SimdInt2 simdAdds2(SimdInt2 x, SimdInt2 y) {
+  return _mm256_adds_epi16(x, y);
+}
+
+static inline SimdInt2 simdSubs2(SimdInt2 x, SimdInt2 y) {
+  return _mm256_subs_epi16(x, y);
+}
+
+static inline SimdInt2 simdMax2(SimdInt2 x, SimdInt2 y) {
+  return _mm256_max_epi16(x, y);
+}
+
+static inline int simdHorizontalMax2(SimdInt2 x) {
+  __m128i z = _mm256_castsi256_si128(x);
+  z = _mm_max_epi16(z, _mm256_extracti128_si256(x, 1));
+  z = _mm_max_epi16(z, _mm_shuffle_epi32(z, 0x4E));
+  z = _mm_max_epi16(z, _mm_shuffle_epi32(z, 0xB1));
+  z = _mm_max_epi16(z, _mm_srli_epi32(z, 16));
+  return (short)_mm_cvtsi128_si32(z);
+}
+
+static inline int simdLast2(SimdInt2 x) {
+  return (short)_mm256_extract_epi16(x, 15);
+}
+
+// Moves the lanes of x up by n = 1, 2, 4, or 8, and puts the last n
+// lanes of y in the first n lanes
+static inline SimdInt2 simdShiftIn2(SimdInt2 x, SimdInt2 y, int n) {
+  __m256i t = _mm256_permute2x128_si256(y, x, 0x21);
+  switch (n) {
+  case 1: return _mm256_alignr_epi8(x, t, 14);
+  case 2: return _mm256_alignr_epi8(x, t, 12);
+  case 4: return _mm256_alignr_epi8(x, t, 8);
+  default: return t;
+  }
+}
+
+// Lane i gets the 16-bit number whose low and high bytes are item
+// p[-i] of lows and highs (made by simdFill16x1).  If any p[-i] >= 16,
+// it returns false, and doesn't set x.
+static inline bool simdChooseBack2(SimdInt2 &x, SimdInt lows, SimdInt highs,
+				   const unsigned char *p) {
+  const __m128i r = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+				 8, 9, 10, 11, 12, 13, 14, 15);
+  __m128i c = _mm_loadu_si128((const __m128i *)(p - 15));
+  if (!_mm_testz_si128(c, _mm_set1_epi8(-16))) return false;
+  c = _mm_shuffle_epi8(c, r);
+  __m128i l = _mm_shuffle_epi8(_mm256_castsi256_si128(lows), c);
+  __m128i h = _mm_shuffle_epi8(_mm256_castsi256_si128(highs), c);
+  x = _mm256_set_m128i(_mm_unpackhi_epi8(l, h), _mm_unpacklo_epi8(l, h));
+  return true;
+}
+
+#if defined __AVX512F__
+
+// AVX-512 for doubles only: the integer functions stay AVX2
+
+typedef __m512d SimdDbl;
+typedef __mmask8 SimdDblMask;
+
+const int simdDblLen = 8;
+
+static inline SimdDbl simdZeroDbl() {
+  return _mm512_setzero_pd();
+}
+
+static inline SimdDbl simdLoadDbl(const double *p) {
+  return _mm512_loadu_pd(p);
+}
+
+static inline void simdStoreDbl(double *p, SimdDbl x) {
+  _mm512_storeu_pd(p, x);
+}
+
+// The first n lanes, 0 <= n <= simdDblLen
+static inline SimdDblMask simdDblMask(int n) {
+  return (1u << n) - 1;
+}
+
+// Load the masked lanes, and set the other lanes to zero
+static inline SimdDbl simdLoadDblMasked(const double *p, SimdDblMask m) {
+  return _mm512_maskz_loadu_pd(m, p);
+}
+
+static inline void simdStoreDblMasked(double *p, SimdDbl x, SimdDblMask m) {
+  _mm512_mask_storeu_pd(p, m, x);
+}
+
+static inline SimdDbl simdSetDbl(double i7, double i6, double i5, double i4,
+				 double i3, double i2, double i1, double i0) {
+  return _mm512_set_pd(i7, i6, i5, i4, i3, i2, i1, i0);
+}
+
+static inline SimdDbl simdFillDbl(double x) {
+  return _mm512_set1_pd(x);
+}
+
+static inline SimdDbl simdAddDbl(SimdDbl x, SimdDbl y) {
+  return _mm512_add_pd(x, y);
+}
+
+static inline SimdDbl simdMulDbl(SimdDbl x, SimdDbl y) {
+  return _mm512_mul_pd(x, y);
+}
+
+static inline SimdDbl simdMaxDbl(SimdDbl x, SimdDbl y) {
+  return _mm512_max_pd(x, y);
+}
+
+// Lane 0 gets first, and lane i gets x[i-1]
+static inline SimdDbl simdShiftInDbl(SimdDbl x, double first) {
+  __m512i y = _mm512_castpd_si512(_mm512_set1_pd(first));
+  return _mm512_castsi512_pd(_mm512_alignr_epi64(_mm512_castpd_si512(x),
+						 y, 7));
+}
+
+static inline double simdHorizontalAddDbl(SimdDbl x) {
+  return _mm512_reduce_add_pd(x);
+}
+
+// Lane i gets table[index[-1-i]], i.e. the indices are read backwards
+// from just before "index"
+static inline SimdDbl simdGatherBackDbl(const double *table,
+					const unsigned char *index) {
+  __m256i i = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(index-8)));
+  i = _mm256_permutevar8x32_epi32(i, _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  return _mm512_i32gather_pd(i, table, 8);
+}
+
+// Lane i gets table[index[i]], where 0 <= index[i] < simdDblLen
+static inline SimdDbl simdLookupDbl(const double *table,
+				    const unsigned char *index) {
+  __m512i i = _mm512_cvtepu8_epi64(_mm_loadl_epi64((const __m128i *)index));
+  return _mm512_permutexvar_pd(i, _mm512_loadu_pd(table));
+}
+
+// Single precision
+
+typedef __m512 SimdFlt;
+typedef __mmask16 SimdFltMask;
+
+const int simdFltLen = 16;
+
+static inline SimdFlt simdZeroFlt() {
+  return _mm512_setzero_ps();
+}
+
+static inline SimdFlt simdLoadFlt(const float *p) {
+  return _mm512_loadu_ps(p);
+}
+
+static inline void simdStoreFlt(float *p, SimdFlt x) {
+  _mm512_storeu_ps(p, x);
+}
+
+// The first n lanes, 0 <= n <= simdFltLen
+static inline SimdFltMask simdFltMask(int n) {
+  return (1u << n) - 1;
+}
+
+// Load the masked lanes, and set the other lanes to zero
+static inline SimdFlt simdLoadFltMasked(const float *p, SimdFltMask m) {
+  return _mm512_maskz_loadu_ps(m, p);
+}
+
+static inline void simdStoreFltMasked(float *p, SimdFlt x, SimdFltMask m) {
+  _mm512_mask_storeu_ps(p, m, x);
+}
+
+static inline SimdFlt simdFillFlt(float x) {
+  return _mm512_set1_ps(x);
+}
+
+static inline SimdFlt simdAddFlt(SimdFlt x, SimdFlt y) {
+  return _mm512_add_ps(x, y);
+}
+
+static inline SimdFlt simdMulFlt(SimdFlt x, SimdFlt y) {
+  return _mm512_mul_ps(x, y);
+}
+
+static inline float simdHorizontalAddFlt(SimdFlt x) {
+  return _mm512_reduce_add_ps(x);
+}
+
+// Bit i is set if x[i] >= y[i]
+static inline int simdGeMaskFlt(SimdFlt x, SimdFlt y) {
+  return _mm512_cmp_ps_mask(x, y, _CMP_GE_OQ);
+}
+
+// Lane i gets table[index[-1-i]]
+static inline SimdFlt simdGatherBackFlt(const float *table,
+					const unsigned char *index) {
+  __m128i x = _mm_loadu_si128((const __m128i *)(index - 16));
+  __m512i i = _mm512_cvtepu8_epi32(x);
+  i = _mm512_permutexvar_epi32(_mm512_set_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+						10, 11, 12, 13, 14, 15), i);
+  return _mm512_i32gather_ps(i, table, 4);
+}
+
+// Lane i gets table[index[i]], where 0 <= index[i] < simdFltLen
+static inline SimdFlt simdLookupFlt(const float *table,
+				    const unsigned char *index) {
+  __m512i i = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)index));
+  return _mm512_permutexvar_ps(i, _mm512_loadu_ps(table));
+}
+
+// Lane i gets rows[i][index[i]]
+static inline SimdFlt simdGatherRowsFlt(const float *const *rows,
+					const unsigned char *index) {
+  __m128i x = _mm_loadu_si128((const __m128i *)index);
+  __m512i i0 = _mm512_slli_epi64(_mm512_cvtepu8_epi64(x), 2);
+  __m512i i1 = _mm512_cvtepu8_epi64(_mm_srli_si128(x, 8));
+  i1 = _mm512_slli_epi64(i1, 2);
+  i0 = _mm512_add_epi64(i0, _mm512_loadu_si512(rows));
+  i1 = _mm512_add_epi64(i1, _mm512_loadu_si512(rows + 8));
+  __m256 lo = _mm512_i64gather_ps(i0, 0, 1);
+  __m256 hi = _mm512_i64gather_ps(i1, 0, 1);
+  __m512d x2 = _mm512_castps_pd(_mm512_castps256_ps512(lo));
+  return _mm512_castpd_ps(_mm512_insertf64x4(x2, _mm256_castps_pd(hi), 1));
+}
+
+
+#else
+
+typedef __m256d SimdDbl;
+
+const int simdDblLen = 4;
+
+static inline SimdDbl simdZeroDbl() {
+  return _mm256_setzero_pd();
+}
+
+static inline SimdDbl simdLoadDbl(const double *p) {
+  return _mm256_loadu_pd(p);
+}
+
+static inline void simdStoreDbl(double *p, SimdDbl x) {
+  _mm256_storeu_pd(p, x);
+}
+
+static inline SimdDbl simdSetDbl(double i3, double i2, double i1, double i0) {
+  return _mm256_set_pd(i3, i2, i1, i0);
+}
+
+static inline SimdDbl simdFillDbl(double x) {
+  return _mm256_set1_pd(x);
+}
+
+static inline SimdDbl simdAddDbl(SimdDbl x, SimdDbl y) {
+  return _mm256_add_pd(x, y);
+}
+
+static inline SimdDbl simdMulDbl(SimdDbl x, SimdDbl y) {
+  return _mm256_mul_pd(x, y);
+}
+
+static inline SimdDbl simdMaxDbl(SimdDbl x, SimdDbl y) {
+  return _mm256_max_pd(x, y);
+}
+
+// Lane 0 gets first, and lane i gets x[i-1]
+static inline SimdDbl simdShiftInDbl(SimdDbl x, double first) {
+  SimdDbl y = _mm256_permute4x64_pd(x, 0x90);
+  return _mm256_blend_pd(y, _mm256_set1_pd(first), 1);
+}
+
 static inline double simdHorizontalAddDbl(SimdDbl x) {
   __m128d z = _mm256_castpd256_pd128(x);
   z = _mm_add_pd(z, _mm256_extractf128_pd(x, 1));
   return _mm_cvtsd_f64(_mm_hadd_pd(z, z));
 }
 
-static inline SimdInt simdChoose1(SimdInt items, SimdInt choices) {
-  return _mm256_shuffle_epi8(items, choices);
+// Lane i gets table[index[i]], where 0 <= index[i] < 2 * simdDblLen.
+// Each half of the table is looked up with a float permute (double k
+// is floats 2k and 2k+1), and index bit 2 chooses between them.
+static inline SimdDbl simdLookupDbl(const double *table,
+				    const unsigned char *index) {
+  unsigned x = index[0] | index[1] << 8 | index[2] << 16 | index[3] << 24;
+  __m256i i = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(x));
+  __m256i j = _mm256_slli_epi64(i, 1);
+  j = _mm256_or_si256(j, _mm256_slli_epi64(j, 32));
+  j = _mm256_add_epi32(j, _mm256_set1_epi64x(1LL << 32));
+  const float *t = (const float *)table;
+  __m256 lo = _mm256_permutevar8x32_ps(_mm256_loadu_ps(t), j);
+  __m256 hi = _mm256_permutevar8x32_ps(_mm256_loadu_ps(t + 8), j);
+  __m256d isHi = _mm256_castsi256_pd(_mm256_slli_epi64(i, 61));
+  return _mm256_blendv_pd(_mm256_castps_pd(lo), _mm256_castps_pd(hi), isHi);
+}
+
+// Single precision
+
+typedef __m256 SimdFlt;
+
+const int simdFltLen = 8;
+
+static inline SimdFlt simdZeroFlt() {
+  return _mm256_setzero_ps();
+}
+
+static inline SimdFlt simdLoadFlt(const float *p) {
+  return _mm256_loadu_ps(p);
+}
+
+static inline void simdStoreFlt(float *p, SimdFlt x) {
+  _mm256_storeu_ps(p, x);
+}
+
+static inline SimdFlt simdFillFlt(float x) {
+  return _mm256_set1_ps(x);
+}
+
+static inline SimdFlt simdAddFlt(SimdFlt x, SimdFlt y) {
+  return _mm256_add_ps(x, y);
+}
+
+static inline SimdFlt simdMulFlt(SimdFlt x, SimdFlt y) {
+  return _mm256_mul_ps(x, y);
 }
 
+static inline float simdHorizontalAddFlt(SimdFlt x) {
+  __m128 z = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+  z = _mm_hadd_ps(z, z);
+  return _mm_cvtss_f32(_mm_hadd_ps(z, z));
+}
+
+// Bit i is set if x[i] >= y[i]
+static inline int simdGeMaskFlt(SimdFlt x, SimdFlt y) {
+  return _mm256_movemask_ps(_mm256_cmp_ps(x, y, _CMP_GE_OQ));
+}
+
+// Lane i gets table[index[-1-i]]
+static inline SimdFlt simdGatherBackFlt(const float *table,
+					const unsigned char *index) {
+  __m256i i = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(index-8)));
+  i = _mm256_permutevar8x32_epi32(i, _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  return _mm256_i32gather_ps(table, i, 4);
+}
+
+// Lane i gets table[index[i]], where 0 <= index[i] < simdFltLen
+static inline SimdFlt simdLookupFlt(const float *table,
+				    const unsigned char *index) {
+  __m256i i = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)index));
+  return _mm256_permutevar8x32_ps(_mm256_loadu_ps(table), i);
+}
+
+// Lane i gets rows[i][index[i]]
+static inline SimdFlt simdGatherRowsFlt(const float *const *rows,
+					const unsigned char *index) {
+  __m128i x = _mm_loadl_epi64((const __m128i *)index);
+  __m256i i0 = _mm256_slli_epi64(_mm256_cvtepu8_epi64(x), 2);
+  __m256i i1 = _mm256_cvtepu8_epi64(_mm_srli_si128(x, 4));
+  i1 = _mm256_slli_epi64(i1, 2);
+  i0 = _mm256_add_epi64(i0, _mm256_loadu_si256((const __m256i *)rows));
+  i1 = _mm256_add_epi64(i1, _mm256_loadu_si256((const __m256i *)(rows + 4)));
+  __m128 lo = _mm256_i64gather_ps((const float *)0, i0, 1);
+  __m128 hi = _mm256_i64gather_ps((const float *)0, i1, 1);
+  return _mm256_set_m128(hi, lo);
+}
+
+
+#endif
+
 #elif defined __SSE4_1__
 
 typedef __m128i SimdInt;
@@ -305,6 +673,15 @@ static inline SimdDbl simdMulDbl(SimdDbl x, SimdDbl y) {
   return _mm_mul_pd(x, y);
 }
 
+static inline SimdDbl simdMaxDbl(SimdDbl x, SimdDbl y) {
+  return _mm_max_pd(x, y);
+}
+
+// Lane 0 gets first, and lane 1 gets x[0]
+static inline SimdDbl simdShiftInDbl(SimdDbl x, double first) {
+  return _mm_shuffle_pd(_mm_set1_pd(first), x, 0);
+}
+
 static inline SimdInt simdQuadruple1(SimdInt x) {
   return _mm_slli_epi32(x, 2);
 }
@@ -337,6 +714,132 @@ static inline SimdInt simdChoose1(SimdInt items, SimdInt choices) {
   return _mm_shuffle_epi8(items, choices);  // SSSE3
 }
 
+static inline SimdInt simdXor1(SimdInt x, SimdInt y) {
+  return _mm_xor_si128(x, y);
+}
+
+// Bit i is the top bit of byte i
+static inline int simdHighBits1(SimdInt x) {
+  return _mm_movemask_epi8(x);
+}
+
+// Puts the 16 bytes at p into each 16-byte part, for simdChoose1
+static inline SimdInt simdFill16x1(const unsigned char *p) {
+  return _mm_loadu_si128((const __m128i *)p);
+}
+
+// 16-bit signed integers, with saturating addition
+
+typedef __m128i SimdInt2;
+
+const int simdLen2 = 8;
+
+static inline SimdInt2 simdLoad2(const short *p) {
+  return _mm_loadu_si128((const SimdInt2 *)p);
+}
+
+static inline void simdStore2(short *p, SimdInt2 x) {
+  _mm_storeu_si128((SimdInt2 *)p, x);
+}
+
+static inline SimdInt2 simdFill2(short x) {
+  return _mm_set1_epi16(x);
+}
+
+static inline SimdInt2 simdAdds2(SimdInt2 x, SimdInt2 y) {
+  return _mm_adds_epi16(x, y);
+}
+
+static inline SimdInt2 simdSubs2(SimdInt2 x, SimdInt2 y) {
+  return _mm_subs_epi16(x, y);
+}
+
+static inline SimdInt2 simdMax2(SimdInt2 x, SimdInt2 y) {
+  return _mm_max_epi16(x, y);
+}
+
+static inline int simdHorizontalMax2(SimdInt2 x) {
+  x = _mm_max_epi16(x, _mm_shuffle_epi32(x, 0x4E));
+  x = _mm_max_epi16(x, _mm_shuffle_epi32(x, 0xB1));
+  x = _mm_max_epi16(x, _mm_srli_epi32(x, 16));
+  return (short)_mm_cvtsi128_si32(x);
+}
+
+static inline int simdLast2(SimdInt2 x) {
+  return (short)_mm_extract_epi16(x, 7);
+}
+
+// Moves the lanes of x up by n = 1, 2, or 4, and puts the last n
+// lanes of y in the first n lanes
+static inline SimdInt2 simdShiftIn2(SimdInt2 x, SimdInt2 y, int n) {
+  switch (n) {
+  case 1: return _mm_alignr_epi8(x, y, 14);  // SSSE3
+  case 2: return _mm_alignr_epi8(x, y, 12);
+  default: return _mm_alignr_epi8(x, y, 8);
+  }
+}
+
+// Lane i gets the 16-bit number whose low and high bytes are item
+// p[-i] of lows and highs (made by simdFill16x1).  If any p[-i] >= 16,
+// it returns false, and doesn't set x.
+static inline bool simdChooseBack2(SimdInt2 &x, SimdInt lows, SimdInt highs,
+				   const unsigned char *p) {
+  const __m128i r = _mm_set_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+				 0, 1, 2, 3, 4, 5, 6, 7);
+  __m128i c = _mm_loadl_epi64((const __m128i *)(p - 7));
+  if (!_mm_testz_si128(c, _mm_set1_epi8(-16))) return false;  // SSE4.1
+  c = _mm_shuffle_epi8(c, r);
+  __m128i l = _mm_shuffle_epi8(lows, c);
+  __m128i h = _mm_shuffle_epi8(highs, c);
+  x = _mm_unpacklo_epi8(l, h);
+  return true;
+}
+
+// Single precision
+
+typedef __m128 SimdFlt;
+
+const int simdFltLen = 4;
+
+static inline SimdFlt simdZeroFlt() {
+  return _mm_setzero_ps();
+}
+
+static inline SimdFlt simdLoadFlt(const float *p) {
+  return _mm_loadu_ps(p);
+}
+
+static inline void simdStoreFlt(float *p, SimdFlt x) {
+  _mm_storeu_ps(p, x);
+}
+
+static inline SimdFlt simdSetFlt(float i3, float i2, float i1, float i0) {
+  return _mm_set_ps(i3, i2, i1, i0);
+}
+
+static inline SimdFlt simdFillFlt(float x) {
+  return _mm_set1_ps(x);
+}
+
+static inline SimdFlt simdAddFlt(SimdFlt x, SimdFlt y) {
+  return _mm_add_ps(x, y);
+}
+
+static inline SimdFlt simdMulFlt(SimdFlt x, SimdFlt y) {
+  return _mm_mul_ps(x, y);
+}
+
+static inline float simdHorizontalAddFlt(SimdFlt x) {
+  x = _mm_hadd_ps(x, x);
+  return _mm_cvtss_f32(_mm_hadd_ps(x, x));
+}
+
+// Bit i is set if x[i] >= y[i]
+static inline int simdGeMaskFlt(SimdFlt x, SimdFlt y) {
+  return _mm_movemask_ps(_mm_cmpge_ps(x, y));
+}
+
+
 #elif defined __ARM_NEON
 
 typedef int32x4_t SimdInt;
@@ -476,6 +979,15 @@ static inline SimdDbl simdMulDbl(SimdDbl x, SimdDbl y) {
   return vmulq_f64(x, y);
 }
 
+static inline SimdDbl simdMaxDbl(SimdDbl x, SimdDbl y) {
+  return vmaxq_f64(x, y);
+}
+
+// Lane 0 gets first, and lane 1 gets x[0]
+static inline SimdDbl simdShiftInDbl(SimdDbl x, double first) {
+  return vextq_f64(vdupq_n_f64(first), x, 1);
+}
+
 static inline SimdUint1 simdQuadruple1(SimdUint1 x) {
   return vshlq_n_u8(x, 2);
 }
@@ -504,6 +1016,100 @@ static inline SimdUint1 simdChoose1(SimdUint1 items, SimdUint1 choices) {
   return vqtbl1q_u8(items, choices);
 }
 
+// 16-bit signed integers, with saturating addition
+
+typedef int16x8_t SimdInt2;
+
+const int simdLen2 = 8;
+
+static inline SimdInt2 simdLoad2(const short *p) {
+  return vld1q_s16(p);
+}
+
+static inline void simdStore2(short *p, SimdInt2 x) {
+  vst1q_s16(p, x);
+}
+
+static inline SimdInt2 simdFill2(short x) {
+  return vdupq_n_s16(x);
+}
+
+static inline SimdInt2 simdAdds2(SimdInt2 x, SimdInt2 y) {
+  return vqaddq_s16(x, y);
+}
+
+static inline SimdInt2 simdSubs2(SimdInt2 x, SimdInt2 y) {
+  return vqsubq_s16(x, y);
+}
+
+static inline SimdInt2 simdMax2(SimdInt2 x, SimdInt2 y) {
+  return vmaxq_s16(x, y);
+}
+
+static inline int simdHorizontalMax2(SimdInt2 x) {
+  return vmaxvq_s16(x);
+}
+
+static inline int simdLast2(SimdInt2 x) {
+  return vgetq_lane_s16(x, 7);
+}
+
+// Moves the lanes of x up by n = 1, 2, or 4, and puts the last n
+// lanes of y in the first n lanes
+static inline SimdInt2 simdShiftIn2(SimdInt2 x, SimdInt2 y, int n) {
+  switch (n) {
+  case 1: return vextq_s16(y, x, 7);
+  case 2: return vextq_s16(y, x, 6);
+  default: return vextq_s16(y, x, 4);
+  }
+}
+
+// Single precision
+
+typedef float32x4_t SimdFlt;
+
+const int simdFltLen = 4;
+
+static inline SimdFlt simdZeroFlt() {
+  return vdupq_n_f32(0);
+}
+
+static inline SimdFlt simdLoadFlt(const float *p) {
+  return vld1q_f32(p);
+}
+
+static inline void simdStoreFlt(float *p, SimdFlt x) {
+  vst1q_f32(p, x);
+}
+
+static inline SimdFlt simdSetFlt(float i3, float i2, float i1, float i0) {
+  float a[] = {i0, i1, i2, i3};
+  return vld1q_f32(a);
+}
+
+static inline SimdFlt simdFillFlt(float x) {
+  return vdupq_n_f32(x);
+}
+
+static inline SimdFlt simdAddFlt(SimdFlt x, SimdFlt y) {
+  return vaddq_f32(x, y);
+}
+
+static inline SimdFlt simdMulFlt(SimdFlt x, SimdFlt y) {
+  return vmulq_f32(x, y);
+}
+
+static inline float simdHorizontalAddFlt(SimdFlt x) {
+  return vaddvq_f32(x);
+}
+
+// Bit i is set if x[i] >= y[i]
+static inline int simdGeMaskFlt(SimdFlt x, SimdFlt y) {
+  const uint32_t bits[] = {1, 2, 4, 8};
+  return vaddvq_u32(vandq_u32(vcgeq_f32(x, y), vld1q_u32(bits)));
+}
+
+
 #else
 
 typedef int SimdInt;
@@ -526,11 +1132,41 @@ static inline int simdAdd(int x, int y) { return x + y; }
 static inline double simdAddDbl(double x, double y) { return x + y; }
 static inline int simdSub(int x, int y) { return x - y; }
 static inline double simdMulDbl(double x, double y) { return x * y; }
+static inline double simdMaxDbl(double x, double y) { return x > y ? x : y; }
+static inline double simdShiftInDbl(double, double first) { return first; }
 static inline int simdMax(int x, int y) { return x > y ? x : y; }
 static inline int simdBlend(int x, int y, int mask) { return mask ? y : x; }
 static inline int simdHorizontalMax(int a) { return a; }
 static inline double simdHorizontalAddDbl(double x) { return x; }
 
+typedef float SimdFlt;
+const int simdFltLen = 1;
+static inline float simdZeroFlt() { return 0; }
+static inline float simdSetFlt(float x) { return x; }
+static inline float simdLoadFlt(const float *p) { return *p; }
+static inline void simdStoreFlt(float *p, float x) { *p = x; }
+static inline float simdFillFlt(float x) { return x; }
+static inline float simdAddFlt(float x, float y) { return x + y; }
+static inline float simdMulFlt(float x, float y) { return x * y; }
+static inline float simdHorizontalAddFlt(float x) { return x; }
+static inline int simdGeMaskFlt(float x, float y) { return x >= y; }
+
+typedef short SimdInt2;
+const int simdLen2 = 1;
+static inline short simdLoad2(const short *p) { return *p; }
+static inline void simdStore2(short *p, short x) { *p = x; }
+static inline short simdFill2(short x) { return x; }
+static inline short simdAdds2(short x, short y) {
+  int z = x + y;  return z < -32768 ? -32768 : z > 32767 ? 32767 : z;
+}
+static inline short simdSubs2(short x, short y) {
+  int z = x - y;  return z < -32768 ? -32768 : z > 32767 ? 32767 : z;
+}
+static inline short simdMax2(short x, short y) { return x > y ? x : y; }
+static inline int simdHorizontalMax2(short x) { return x; }
+static inline int simdLast2(short x) { return x; }
+static inline short simdShiftIn2(short, short y, int) { return y; }
+
 #endif
 
 }
@@ -3,7 +3,9 @@
 #include "mcf_tantan_options.hh"
 
 #include "mcf_util.hh"
+#include "tantan.hh"
 
+#include <getopt.h>
 #include <unistd.h>
 
 #include <limits.h>
@@ -20,19 +22,35 @@ static void badopt(char opt, const char *arg) {
   throw Error(std::string("bad option value: -") + opt + " " + arg);
 }
 
+static void badLongOpt(const char *opt, const char *arg) {
+  throw Error(std::string("bad option value: --") + opt + "=" + arg);
+}
+
+// Gets a letter count, rejecting negative values and values so big
+// that adding a few of them could overflow
+static size_t letterCountOpt(const char *opt, const char *arg) {
+  long x;
+  unstringify(x, arg);
+  if (x < 0 || x > LONG_MAX / 4)
+    badLongOpt(opt, arg);
+  return x;
+}
+
 static void writeAndQuit(const std::string &text) {
   std::cout << text;
   throw EXIT_SUCCESS;
 }
 
 static int myGetopt(int argc, char **argv, const char *optstring,
+                    const struct option *longopts,
                     const std::string &help, const std::string &version) {
   if (optind < argc) {
     std::string nextarg = argv[optind];
     if (nextarg == "--help")    writeAndQuit(help);
-    if (nextarg == "--version") writeAndQuit(version);
+    if (nextarg == "--version")
+      writeAndQuit(version + "SIMD: " + tantan::simdName() + "\n");
   }
-  return getopt(argc, argv, optstring);
+  return getopt_long(argc, argv, optstring, longopts, 0);
 }
 
 std::istream &operator>>(std::istream &s, TantanOptions::OutputType &x) {
@@ -61,6 +79,17 @@ TantanOptions::TantanOptions() :
     minMaskProb(0.5),
     minCopyNumber(2.0),
     outputType(maskOut),
+    numOfThreads(1),
+    windowLength(0),
+    windowOverlap(-1),
+    isExactWindows(false),
+    isBidirectional(false),
+    isCheckpointed(false),
+    lag(0),
+    isMapped(false),
+    isCheck(false),
+    isIntegerViterbi(false),
+    outputSuffix(0),
     indexOfFirstNonOptionArgument(-1) {}
 
 void TantanOptions::fromArgs(int argc, char **argv) {
@@ -92,8 +121,33 @@ Options (default settings):\n\
  -f  output type: 0=masked sequence, 1=repeat probabilities,\n\
                   2=repeat counts, 3=BED, 4=tandem repeats ("
       + stringify(outputType) + ")\n\
+ -t  number of threads ("
+      + stringify(numOfThreads) + ")\n\
+ --suffix=S  write the output for each input file to a file with the same\n\
+             name (minus .gz) plus S\n\
+ --simd=NAME  SIMD instruction set: auto, scalar, sse4, avx2, avx512 (auto)\n\
+ --float     calculate in single precision: faster, slightly less accurate\n\
+ --int16     -f4: calculate with 16-bit integers: faster, slightly less\n\
+             accurate\n\
  -h, --help  show help message, then exit\n\
  --version   show version information, then exit\n\
+\n\
+Options for long sequences:\n\
+ --window=N   split sequences into windows of N letters, and do the windows\n\
+              in parallel (approximate)\n\
+ --overlap=N  extend each window by N letters on both sides\n\
+              (4 * period + length over which a repeat persists, see -e)\n\
+ --exact      make the windows exact, without overlap, by calculating how\n\
+              each window transforms the algorithm's state\n\
+ --bidirectional  do each sequence's forward and backward passes at the\n\
+              same time, in 2 threads\n\
+ --checkpoints  -f0, -f3: mask each sequence with memory proportional to\n\
+              the square root of its length, by redoing calculations\n\
+ --lag=N      -f0, -f1, -f3: write each sequence's output while reading it,\n\
+              using only the next N letters for each letter (approximate)\n\
+ --mmap       -f0: memory-map uncompressed input files, and keep their line\n\
+              layout in the output\n\
+ --check      report the maximum difference from the basic calculation\n\
 ";
   // -k for transition cost?
 
@@ -101,12 +155,31 @@ Options (default settings):\n\
 #include "version.hh"
       "\n";
 
-  const char *optstring = "px:cm:r:e:w:d:i:j:a:b:s:n:f:h";
+  const char *optstring = "px:cm:r:e:w:d:i:j:a:b:s:n:f:t:h";
+
+  enum { windowOpt = 256, overlapOpt, exactOpt, bidirectionalOpt, checkOpt,
+	 suffixOpt, simdOpt, floatOpt, int16Opt, checkpointsOpt,
+	 lagOpt, mmapOpt };
+  static const struct option longopts[] = {
+    {"window",  required_argument, 0, windowOpt},
+    {"overlap", required_argument, 0, overlapOpt},
+    {"exact",   no_argument,       0, exactOpt},
+    {"bidirectional", no_argument, 0, bidirectionalOpt},
+    {"checkpoints", no_argument,   0, checkpointsOpt},
+    {"lag",     required_argument, 0, lagOpt},
+    {"mmap",    no_argument,       0, mmapOpt},
+    {"check",   no_argument,       0, checkOpt},
+    {"suffix",  required_argument, 0, suffixOpt},
+    {"simd",    required_argument, 0, simdOpt},
+    {"float",   no_argument,       0, floatOpt},
+    {"int16",   no_argument,       0, int16Opt},
+    {0, 0, 0, 0}
+  };
 
   int i;
-  while ((i = myGetopt(argc, argv, optstring, help, version)) != -1) {
+  while ((i = myGetopt(argc, argv, optstring, longopts, help, version)) != -1) {
     char c = static_cast<char>(i);
-    switch (c) {
+    switch (i) {
       case 'p':
         isProtein = true;
         break;
@@ -167,6 +240,50 @@ Options (default settings):\n\
       case 'f':
         unstringify(outputType, optarg);
         break;
+      case 't':
+        unstringify(numOfThreads, optarg);
+        if (numOfThreads <= 0)
+          badopt(c, optarg);
+        break;
+      case windowOpt:
+        windowLength = letterCountOpt("window", optarg);
+        break;
+      case overlapOpt:
+        unstringify(windowOverlap, optarg);
+        if (windowOverlap < 0)
+          badLongOpt("overlap", optarg);
+        break;
+      case exactOpt:
+        isExactWindows = true;
+        break;
+      case bidirectionalOpt:
+        isBidirectional = true;
+        break;
+      case checkpointsOpt:
+        isCheckpointed = true;
+        break;
+      case lagOpt:
+        lag = letterCountOpt("lag", optarg);
+        break;
+      case mmapOpt:
+        isMapped = true;
+        break;
+      case checkOpt:
+        isCheck = true;
+        break;
+      case suffixOpt:
+        outputSuffix = optarg;
+        break;
+      case simdOpt:
+        if (!tantan::setSimd(optarg))
+          badLongOpt("simd", optarg);
+        break;
+      case floatOpt:
+        tantan::setSinglePrecision(true);
+        break;
+      case int16Opt:
+        isIntegerViterbi = true;
+        break;
       case 'h':
         writeAndQuit(help);
       case '?':
@@ -181,6 +298,13 @@ Options (default settings):\n\
 
   if (maxCycleLength < 0) maxCycleLength = (isProtein ? 50 : 100);
 
+  // --exact stores a (states x states) map per window, so the windows
+  // mustn't be too short:
+  size_t minExactWindow = size_t(maxCycleLength) * maxCycleLength;
+  if (isExactWindows && windowLength > 0 && windowLength < minExactWindow)
+    throw Error("--exact needs --window of at least " +
+		stringify(minExactWindow) + " (the square of -w)");
+
   if (mismatchCost == 0) mismatchCost = INT_MAX;
 
   if (!isProtein || matchScore > 0 || mismatchCost > 0) {
@@ -3,6 +3,8 @@
 #ifndef MCF_TANTAN_OPTIONS_HH
 #define MCF_TANTAN_OPTIONS_HH
 
+#include <stddef.h>  // size_t
+
 namespace mcf {
 
 struct TantanOptions {
@@ -25,6 +27,17 @@ struct TantanOptions {
   double minMaskProb;
   double minCopyNumber;
   enum OutputType { maskOut, probOut, countOut, bedOut, repOut } outputType;
+  int numOfThreads;
+  size_t windowLength;  // 0 means: don't split sequences into windows
+  long windowOverlap;  // negative means: use the default
+  bool isExactWindows;  // split sequences into exact chunks?
+  bool isBidirectional;  // do forward and backward passes at the same time?
+  bool isCheckpointed;  // mask without storing all the probabilities?
+  size_t lag;  // 0 means: don't stream, else look-ahead per letter
+  bool isMapped;  // memory-map input files, and mask them in place?
+  bool isCheck;  // compare with the basic calculation?
+  bool isIntegerViterbi;  // -f4 with 16-bit integer scores?
+  const char *outputSuffix;  // 0 means: write all output to stdout
 
   int indexOfFirstNonOptionArgument;
 };
@@ -6,9 +6,10 @@
 
 namespace mcf {
 
-std::istream &openIn(const std::string &fileName, izstream &z) {
+std::istream &openIn(const std::string &fileName, izstream &z,
+		     int numOfThreads) {
   if (fileName == "-") return std::cin;
-  z.open(fileName.c_str());
+  z.open(fileName.c_str(), numOfThreads);
   if (!z) throw std::runtime_error("can't open file: " + fileName);
   return z;
 }
@@ -13,8 +13,10 @@
 
 namespace mcf {
 
-// open an input file, but if the name is "-", just return cin
-std::istream &openIn(const std::string &fileName, izstream &z);
+// open an input file, but if the name is "-", just return cin.  If
+// the file is BGZF, numOfThreads threads decompress it.
+std::istream &openIn(const std::string &fileName, izstream &z,
+		     int numOfThreads = 1);
 
 // open an output file, but if the name is "-", just return cout
 std::ostream &openOut(const std::string &fileName, std::ofstream &ofs);
@@ -0,0 +1,300 @@
+// Copyright 2017 Martin C. Frith
+
+#include "mcf_zstream.hh"
+#include "mcf_pipeline.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>  // max
+#include <stdexcept>
+
+namespace mcf {
+
+// enough that thread synchronization is negligible:
+static const size_t chunkSize = 1 << 20;
+
+static const size_t bgzfHeaderSize = 18;
+static const size_t bgzfTrailerSize = 8;
+static const size_t bgzfMaxBlockSize = 65536;  // uncompressed
+
+typedef unsigned char uchar;
+
+// A chunk of decompressed data.  For BGZF, the reader thread puts
+// compressed blocks in input, and a worker thread decompresses them.
+struct zbuf::Job {
+  std::vector<char> input;
+  std::vector<char> output;
+  size_t outputSize;
+};
+
+// Thrown to stop the decompressor, when the stream is closed early
+namespace { struct Stopped {}; }
+
+static unsigned get16(const char *s) {
+  return uchar(s[0]) | uchar(s[1]) << 8;
+}
+
+static unsigned long get32(const char *s) {
+  return get16(s) | (unsigned long)get16(s + 2) << 16;
+}
+
+static bool isGzipHeader(const char *s) {
+  return uchar(s[0]) == 0x1f && uchar(s[1]) == 0x8b;
+}
+
+// A gzip header with an extra field that has just the BGZF block size
+static bool isBgzfHeader(const char *s) {
+  return isGzipHeader(s) && s[2] == 8 && (s[3] & 4) && get16(s + 10) == 6 &&
+    s[12] == 'B' && s[13] == 'C' && get16(s + 14) == 2;
+}
+
+// Decompresses BGZF blocks, and checks their lengths and CRCs
+static void inflateBlocks(const std::vector<char> &input,
+			  std::vector<char> &output, size_t &outputSize) {
+  size_t size = 0;
+  for (size_t i = 0; i < input.size(); ) {
+    size_t end = (input.size() - i < bgzfHeaderSize) ? 0 :
+      i + get16(&input[i + 16]) + 1;
+    if (end < i + bgzfHeaderSize + bgzfTrailerSize || end > input.size() ||
+	get32(&input[end - 4]) > bgzfMaxBlockSize)
+      throw std::runtime_error("bad BGZF block");
+    size += get32(&input[end - 4]);
+    i = end;
+  }
+  if (output.size() < size) output.resize(size);
+  outputSize = size;
+
+  z_stream z;
+  z.zalloc = Z_NULL;
+  z.zfree = Z_NULL;
+  z.opaque = Z_NULL;
+  z.next_in = Z_NULL;
+  z.avail_in = 0;
+  if (inflateInit2(&z, -15) != Z_OK)  // raw deflate data
+    throw std::runtime_error("can't initialize zlib");
+
+  size_t done = 0;
+  bool isOk = true;
+  for (size_t i = 0; isOk && i < input.size(); ) {
+    size_t end = i + get16(&input[i + 16]) + 1;
+    unsigned long crc = get32(&input[end - 8]);
+    unsigned long blockSize = get32(&input[end - 4]);
+    Bytef *out = reinterpret_cast<Bytef *>(output.data() + done);
+    inflateReset(&z);
+    z.next_in = (Bytef *)(&input[i + bgzfHeaderSize]);
+    z.avail_in = end - bgzfTrailerSize - (i + bgzfHeaderSize);
+    z.next_out = out;
+    z.avail_out = blockSize;
+    isOk = inflate(&z, Z_FINISH) == Z_STREAM_END && z.avail_out == 0 &&
+      crc32(crc32(0, Z_NULL, 0), out, blockSize) == crc;
+    done += blockSize;
+    i = end;
+  }
+
+  inflateEnd(&z);
+  if (!isOk) throw std::runtime_error("bad BGZF block");
+}
+
+zbuf *zbuf::open(const char *fileName, int numOfThreads) {
+  if (is_open()) return 0;
+  fd = ::open(fileName, O_RDONLY);
+  if (!is_open()) return 0;
+
+  gzipStream.zalloc = Z_NULL;
+  gzipStream.zfree = Z_NULL;
+  gzipStream.opaque = Z_NULL;
+  gzipStream.next_in = Z_NULL;
+  gzipStream.avail_in = 0;
+  if (inflateInit2(&gzipStream, 15 + 16) != Z_OK) {  // gzip format
+    ::close(fd);
+    fd = -1;
+    return 0;
+  }
+
+  this->numOfThreads = std::max(numOfThreads, 1);
+  rawBeg = rawEnd = 0;
+  isInMember = false;
+  isEndOfGzip = false;
+  isReady = false;
+  isFinished = false;
+  isClosing = false;
+  error = 0;
+  setg(0, 0, 0);
+  decompressor = std::thread(&zbuf::decompress, this);
+  return this;
+}
+
+zbuf *zbuf::close() {
+  if (!is_open()) return 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    isClosing = true;
+    changed.notify_all();
+  }
+  decompressor.join();
+  inflateEnd(&gzipStream);
+  int e = ::close(fd);
+  fd = -1;
+  return (e == 0) ? this : 0;
+}
+
+int zbuf::underflow() {
+  while (gptr() == egptr()) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!isReady && !isFinished) changed.wait(lock);
+    if (!isReady) {
+      if (!error) break;
+      std::exception_ptr e = error;
+      error = 0;
+      std::rethrow_exception(e);
+    }
+    current.swap(ready);
+    isReady = false;
+    changed.notify_all();
+    setg(current.data(), current.data(), current.data() + readySize);
+  }
+  return (gptr() == egptr()) ?
+    traits_type::eof() : traits_type::to_int_type(*gptr());
+}
+
+// Runs in the background thread
+void zbuf::decompress() {
+  try {
+    fillRaw(bgzfHeaderSize);
+    const char *s = rawData.data() + rawBeg;
+    size_t size = rawEnd - rawBeg;
+    format = (size >= bgzfHeaderSize && isBgzfHeader(s)) ? isBgzf
+      :      (size >= 2 && isGzipHeader(s)) ? isGzip : isRaw;
+    // Only BGZF is decompressed by workers: else, read a little ahead
+    int numOfWorkers = (format == isBgzf) ? numOfThreads : 1;
+    Pipeline<Job> pipeline;
+    pipeline.run(numOfWorkers, numOfWorkers * 4,
+		 [this](Job &job) { return readJob(job); },
+		 [](Job &job) {
+		   if (!job.input.empty())
+		     inflateBlocks(job.input, job.output, job.outputSize);
+		 },
+		 [this](Job &job) { handOver(job); });
+  } catch (const Stopped &) {
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex);
+    error = std::current_exception();
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  isFinished = true;
+  changed.notify_all();
+}
+
+// Waits until underflow has taken the previous chunk
+void zbuf::handOver(Job &job) {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (isReady && !isClosing) changed.wait(lock);
+  if (isClosing) throw Stopped();
+  ready.swap(job.output);
+  readySize = job.outputSize;
+  isReady = true;
+  changed.notify_all();
+}
+
+// Reads until there are at least minSize unused bytes: returns false
+// if the file ends first
+bool zbuf::fillRaw(size_t minSize) {
+  while (rawEnd - rawBeg < minSize) {
+    if (rawBeg > 0) {
+      memmove(&rawData[0], &rawData[rawBeg], rawEnd - rawBeg);
+      rawEnd -= rawBeg;
+      rawBeg = 0;
+    }
+    size_t size = std::max(minSize, chunkSize);
+    if (rawData.size() < size) rawData.resize(size);
+    ssize_t n = ::read(fd, &rawData[rawEnd], rawData.size() - rawEnd);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) throw std::runtime_error("can't read compressed file");
+    if (n == 0) return false;
+    rawEnd += n;
+  }
+  return true;
+}
+
+bool zbuf::readJob(Job &job) {
+  job.input.clear();
+  job.outputSize = 0;
+  if (format == isBgzf && readBgzfJob(job)) return true;
+  if (format == isGzip) return readGzipJob(job);
+  if (format == isRaw) return readRawJob(job);
+  return false;
+}
+
+// Uncompressed input is passed through as is
+bool zbuf::readRawJob(Job &job) {
+  if (!fillRaw(1)) return false;
+  size_t size = rawEnd - rawBeg;
+  if (job.output.size() < size) job.output.resize(size);
+  memcpy(&job.output[0], &rawData[rawBeg], size);
+  job.outputSize = size;
+  rawBeg = rawEnd;
+  return true;
+}
+
+// Decompresses ordinary gzip right here, like gzread: it goes on to
+// any following gzip members, and ignores trailing junk.  But unlike
+// gzread, it complains if the input is truncated.
+bool zbuf::readGzipJob(Job &job) {
+  if (job.output.size() < chunkSize) job.output.resize(chunkSize);
+  z_stream &z = gzipStream;
+  Bytef *out = reinterpret_cast<Bytef *>(&job.output[0]);
+  z.next_out = out;
+  z.avail_out = chunkSize;
+  while (z.avail_out > 0 && !isEndOfGzip) {
+    if (!isInMember) {
+      if (!fillRaw(2) || !isGzipHeader(&rawData[rawBeg])) {
+	isEndOfGzip = true;
+	break;
+      }
+      inflateReset(&z);
+      isInMember = true;
+    }
+    if (rawBeg == rawEnd && !fillRaw(1))
+      throw std::runtime_error("truncated gzip file");
+    z.next_in = reinterpret_cast<Bytef *>(&rawData[rawBeg]);
+    z.avail_in = rawEnd - rawBeg;
+    int e = inflate(&z, Z_NO_FLUSH);
+    rawBeg = rawEnd - z.avail_in;
+    if (e == Z_STREAM_END) isInMember = false;
+    else if (e != Z_OK && e != Z_BUF_ERROR)
+      throw std::runtime_error("gzip decompression error");
+  }
+  job.outputSize = z.next_out - out;
+  return job.outputSize > 0;
+}
+
+// Gets whole BGZF blocks for a worker to decompress.  If it meets a
+// non-BGZF gzip member, the rest of the input is read as ordinary
+// gzip.
+bool zbuf::readBgzfJob(Job &job) {
+  while (job.input.size() < chunkSize) {
+    if (!fillRaw(bgzfHeaderSize)) {
+      if (rawEnd > rawBeg) format = isGzip;
+      break;
+    }
+    const char *s = &rawData[rawBeg];
+    if (!isBgzfHeader(s)) {
+      format = isGzip;
+      break;
+    }
+    size_t blockSize = get16(s + 16) + 1;
+    if (blockSize < bgzfHeaderSize + bgzfTrailerSize)
+      throw std::runtime_error("bad BGZF block");
+    if (!fillRaw(blockSize))
+      throw std::runtime_error("truncated gzip file");
+    s = &rawData[rawBeg];
+    job.input.insert(job.input.end(), s, s + blockSize);
+    rawBeg += blockSize;
+  }
+  return !job.input.empty();
+}
+
+}
@@ -4,69 +4,91 @@
 // you give it a gzip-compressed file, it will decompress what it
 // reads.
 
+// The reading and decompressing happens in a background thread, in
+// big chunks, so it overlaps with whatever the caller does.  If the
+// file is BGZF (blocked gzip, made by e.g. bgzip), whose blocks can
+// be decompressed independently, it decompresses numOfThreads
+// batches of blocks at once.
+
 #ifndef MCF_ZSTREAM_HH
 #define MCF_ZSTREAM_HH
 
 #include <zlib.h>
 
-#include <cstdio>  // BUFSIZ
+#include <condition_variable>
+#include <exception>
 #include <istream>
-#include <stdexcept>
+#include <mutex>
 #include <streambuf>
+#include <thread>
+#include <vector>
 
 namespace mcf {
 
 class zbuf : public std::streambuf {
 public:
-  zbuf() : input(0) {}
+  zbuf() : fd(-1) {}
 
   ~zbuf() { close(); }
 
-  bool is_open() const { return input; }
+  bool is_open() const { return fd >= 0; }
 
-  zbuf *open(const char *fileName) {
-    if (is_open()) return 0;
-    input = gzopen(fileName, "rb");
-    if (!is_open()) return 0;
-    return this;
-  }
+  zbuf *open(const char *fileName, int numOfThreads = 1);
 
-  zbuf *close() {
-    if (!is_open()) return 0;
-    int e = gzclose(input);
-    input = 0;
-    return (e == Z_OK || e == Z_BUF_ERROR) ? this : 0;
-  }
+  zbuf *close();
 
 protected:
-  int underflow() {
-    if (gptr() == egptr()) {
-      int size = gzread(input, buffer, BUFSIZ);
-      if (size < 0) throw std::runtime_error("gzread error");
-      setg(buffer, buffer, buffer + size);
-    }
-    return (gptr() == egptr()) ?
-      traits_type::eof() : traits_type::to_int_type(*gptr());
-  }
+  int underflow();
 
 private:
-  gzFile input;
-  char buffer[BUFSIZ];
+  struct Job;
+
+  int fd;
+  int numOfThreads;
+  enum { isRaw, isGzip, isBgzf } format;
+  std::vector<char> rawData;  // input that hasn't been decompressed
+  size_t rawBeg;
+  size_t rawEnd;
+  z_stream gzipStream;
+  bool isInMember;  // in the middle of a gzip member?
+  bool isEndOfGzip;
+
+  std::thread decompressor;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<char> ready;  // decompressed, for underflow to take next
+  size_t readySize;
+  bool isReady;
+  bool isFinished;  // the decompressor has nothing more to give
+  bool isClosing;
+  std::exception_ptr error;
+  std::vector<char> current;  // the get area
+
+  void decompress();
+  bool fillRaw(size_t minSize);
+  bool readJob(Job &job);
+  bool readRawJob(Job &job);
+  bool readGzipJob(Job &job);
+  bool readBgzfJob(Job &job);
+  void handOver(Job &job);
 };
 
 class izstream : public std::istream {
 public:
-  izstream() : std::istream(&buf) {}
+  // Decompression errors are thrown, not just flagged by badbit
+  izstream() : std::istream(&buf) { exceptions(badbit); }
 
-  izstream(const char *fileName) : std::istream(&buf) {
-    open(fileName);
+  izstream(const char *fileName, int numOfThreads = 1)
+    : std::istream(&buf) {
+    exceptions(badbit);
+    open(fileName, numOfThreads);
   }
 
   bool is_open() const { return buf.is_open(); }
 
-  void open(const char *fileName) {
+  void open(const char *fileName, int numOfThreads = 1) {
     // do something special if fileName is "-"?
-    if (!buf.open(fileName)) setstate(failbit);
+    if (!buf.open(fileName, numOfThreads)) setstate(failbit);
     else clear();
   }
 
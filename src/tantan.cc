@@ -1,27 +1,98 @@
 // Copyright 2010 Martin C. Frith
 
-#include "tantan.hh"
-#include "mcf_simd.hh"
+// This file may be compiled with SIMD instruction flags (see the
+// Makefile), but the other headers' inline functions and templates
+// (e.g. std::vector) are compiled for the baseline instruction set.
+// Their copies in the different SIMD objects have the same names, and
+// the linker keeps an arbitrary one, so they must all run on any CPU.
+// Our own code is in a per-SIMD namespace, and mcf_simd.hh has only
+// static functions, so they are unaffected.
+#if defined __x86_64__ || defined __i386__
+#if defined __clang__
+#pragma clang attribute push(__attribute__((target("no-sse3"))), \
+                             apply_to = function)
+#elif defined __GNUC__
+#pragma GCC push_options
+#pragma GCC target("no-sse3")
+#endif
+#endif
+
+#include "tantan_simd.hh"
 
 #include <algorithm>  // fill, max
+#include <atomic>
 #include <cassert>
-#include <cmath>  // pow, abs
+#include <climits>  // SHRT_MIN, SHRT_MAX
+#include <cmath>  // pow, abs, log, log1p, ceil, sqrt, nextafter
 #include <iostream>  // cerr
-#include <numeric>  // accumulate
+#include <limits>
+#include <numeric>  // accumulate, inner_product
+#include <thread>
 #include <vector>
 
+#if defined __x86_64__ || defined __i386__
+#if defined __clang__
+#pragma clang attribute pop
+#elif defined __GNUC__
+#pragma GCC pop_options
+#endif
+#endif
+
+#include "mcf_simd.hh"
+
 #define BEG(v) ((v).empty() ? 0 : &(v).front())
 #define END(v) ((v).empty() ? 0 : &(v).back() + 1)
 
+// The namespace for this compilation's SIMD instruction set (see
+// tantan_simd.hh):
+#ifndef TANTAN_SIMD
+#define TANTAN_SIMD native
+#endif
+
+#define TANTAN_STRINGIFY(x) #x
+#define TANTAN_NAME(x) TANTAN_STRINGIFY(x)
+
 namespace tantan {
+namespace TANTAN_SIMD {
 
 using namespace mcf;
 
-void multiplyAll(std::vector<double> &v, double factor) {
-  for (std::vector<double>::iterator i = v.begin(); i < v.end(); ++i)
+// Calls f(0), f(1), ..., f(n-1), using up to numOfThreads threads
+template <typename Function>
+void parallelFor(size_t n, int numOfThreads, Function f) {
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t i; (i = next++) < n; ) f(i);
+  };
+  std::vector<std::thread> threads;
+  for (int t = 1; t < numOfThreads && size_t(t) < n; ++t)
+    threads.push_back(std::thread(work));
+  work();
+  for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+}
+
+double dotProduct(const std::vector<double> &x, const std::vector<double> &y) {
+  return std::inner_product(x.begin(), x.end(), y.begin(), 0.0);
+}
+
+template <typename T>
+void multiplyAll(std::vector<T> &v, T factor) {
+  for (typename std::vector<T>::iterator i = v.begin(); i < v.end(); ++i)
     *i *= factor;
 }
 
+// y = matrix * x, where matrix is column-major, and then divide y by
+// its first element
+void multiplyAndNormalize(const double *matrix, const std::vector<double> &x,
+                          std::vector<double> &y) {
+  size_t n = x.size();
+  std::fill(y.begin(), y.end(), 0.0);
+  for (size_t j = 0; j < n; ++j)
+    for (size_t i = 0; i < n; ++i)
+      y[i] += matrix[j * n + i] * x[j];
+  multiplyAll(y, 1 / y[0]);
+}
+
 double firstRepeatOffsetProb(double probMult, int maxRepeatOffset) {
   if (probMult < 1 || probMult > 1) {
     return (1 - probMult) / (1 - std::pow(probMult, maxRepeatOffset));
@@ -29,19 +100,220 @@ double firstRepeatOffsetProb(double probMult, int maxRepeatOffset) {
   return 1.0 / maxRepeatOffset;
 }
 
-void checkForwardAndBackwardTotals(double fTot, double bTot) {
+// The SIMD operations for each floating-point type.  gatherBack gets
+// the likelihood ratios lrRow[sp[-1]], lrRow[sp[-2]], etc., one per
+// lane, and gatherRows gets lrRows[0][s[0]], lrRows[1][s[1]], etc.
+// lookup gets table[codes[0]], table[codes[1]], etc., with vector
+// permutes instead of scalar loads, for codes < tableLen (if tableLen
+// is 0, there is no such permute).  The AVX-512 masks are for partial
+// vectors.  max and shiftIn (lane 0 gets first, lane i gets x[i-1])
+// are for the Viterbi algorithm, which is double-precision only.
+
+template <typename T> struct Simd;
+
+template <> struct Simd<double> {
+  typedef SimdDbl V;
+  enum { len = simdDblLen };
+  static V zero() { return simdZeroDbl(); }
+  static V load(const double *p) { return simdLoadDbl(p); }
+  static void store(double *p, V x) { simdStoreDbl(p, x); }
+  static V fill(double x) { return simdFillDbl(x); }
+  static V add(V x, V y) { return simdAddDbl(x, y); }
+  static V mul(V x, V y) { return simdMulDbl(x, y); }
+  static double sum(V x) { return simdHorizontalAddDbl(x); }
+  static V max(V x, V y) { return simdMaxDbl(x, y); }
+  static V shiftIn(V x, double first) { return simdShiftInDbl(x, first); }
+
+  static V gatherRows(const double *const *lrRows, const uchar *s) {
+    return simdSetDbl(
+#if defined __SSE4_1__ || defined __ARM_NEON
+#ifdef __AVX2__
+#ifdef __AVX512F__
+		      lrRows[7][s[7]],
+		      lrRows[6][s[6]],
+		      lrRows[5][s[5]],
+		      lrRows[4][s[4]],
+#endif
+		      lrRows[3][s[3]],
+		      lrRows[2][s[2]],
+#endif
+		      lrRows[1][s[1]],
+#endif
+		      lrRows[0][s[0]]);
+  }
+
+  static V gatherBack(const double *lrRow, const uchar *sp) {
+#ifdef __AVX512F__
+    return simdGatherBackDbl(lrRow, sp);
+#else
+    return simdSetDbl(
+#if defined __SSE4_1__ || defined __ARM_NEON
+#ifdef __AVX2__
+		      lrRow[sp[-4]],
+		      lrRow[sp[-3]],
+#endif
+		      lrRow[sp[-2]],
+#endif
+		      lrRow[sp[-1]]);
+#endif
+  }
+
+#if defined __AVX512F__
+  enum { tableLen = simdDblLen };
+  static V lookup(const double *table, const uchar *codes) {
+    return simdLookupDbl(table, codes);
+  }
+#elif defined __AVX2__
+  enum { tableLen = 2 * simdDblLen };  // enough for ACGTN
+  static V lookup(const double *table, const uchar *codes) {
+    return simdLookupDbl(table, codes);
+  }
+#else
+  enum { tableLen = 0 };
+  static V lookup(const double *, const uchar *) { return zero(); }
+#endif
+
+#ifdef __AVX512F__
+  typedef SimdDblMask Mask;
+  static Mask mask(int n) { return simdDblMask(n); }
+  static V loadMasked(const double *p, Mask m) {
+    return simdLoadDblMasked(p, m);
+  }
+  static void storeMasked(double *p, V x, Mask m) {
+    simdStoreDblMasked(p, x, m);
+  }
+#endif
+};
+
+template <> struct Simd<float> {
+  typedef SimdFlt V;
+  enum { len = simdFltLen };
+  static V zero() { return simdZeroFlt(); }
+  static V load(const float *p) { return simdLoadFlt(p); }
+  static void store(float *p, V x) { simdStoreFlt(p, x); }
+  static V fill(float x) { return simdFillFlt(x); }
+  static V add(V x, V y) { return simdAddFlt(x, y); }
+  static V mul(V x, V y) { return simdMulFlt(x, y); }
+  static float sum(V x) { return simdHorizontalAddFlt(x); }
+
+  static V gatherRows(const float *const *lrRows, const uchar *s) {
+#ifdef __AVX2__
+    return simdGatherRowsFlt(lrRows, s);
+#else
+    return simdSetFlt(
+#if defined __SSE4_1__ || defined __ARM_NEON
+		      lrRows[3][s[3]],
+		      lrRows[2][s[2]],
+		      lrRows[1][s[1]],
+#endif
+		      lrRows[0][s[0]]);
+#endif
+  }
+
+  static V gatherBack(const float *lrRow, const uchar *sp) {
+#ifdef __AVX2__
+    return simdGatherBackFlt(lrRow, sp);
+#else
+    return simdSetFlt(
+#if defined __SSE4_1__ || defined __ARM_NEON
+		      lrRow[sp[-4]],
+		      lrRow[sp[-3]],
+		      lrRow[sp[-2]],
+#endif
+		      lrRow[sp[-1]]);
+#endif
+  }
+
+#ifdef __AVX2__
+  enum { tableLen = simdFltLen };
+  static V lookup(const float *table, const uchar *codes) {
+    return simdLookupFlt(table, codes);
+  }
+#else
+  enum { tableLen = 0 };
+  static V lookup(const float *, const uchar *) { return zero(); }
+#endif
+
+#ifdef __AVX512F__
+  typedef SimdFltMask Mask;
+  static Mask mask(int n) { return simdFltMask(n); }
+  static V loadMasked(const float *p, Mask m) {
+    return simdLoadFltMasked(p, m);
+  }
+  static void storeMasked(float *p, V x, Mask m) {
+    simdStoreFltMasked(p, x, m);
+  }
+#endif
+};
+
+// The totals drift apart by rounding error, which is much bigger in
+// single precision
+template <typename T>
+void checkForwardAndBackwardTotals(T fTot, T bTot) {
   double x = std::abs(fTot);
   double y = std::abs(bTot);
+  double tolerance = (sizeof(T) < sizeof(double)) ? 1e-2 : 1e-6;
 
   // ??? Is 1e6 suitable here ???
-  if (std::abs(fTot - bTot) > std::max(x, y) / 1e6)
+  if (std::abs(fTot - bTot) > std::max(x, y) * tolerance)
     std::cerr << "tantan: warning: possible numeric inaccuracy\n"
               << "tantan:          forward algorithm total: " << fTot << "\n"
               << "tantan:          backward algorithm total: " << bTot << "\n";
 }
 
+// For small alphabets (e.g. DNA): the sequence's letters are recoded
+// as 0, 1, 2, ..., and stored in reverse order, so that the letters
+// before a position can be read forwards with one SIMD load.  Each
+// letter's likelihood ratios with the codes fit in one or two SIMD
+// vectors, so the emission probabilities need just one or two
+// permutes per vector.
+
+template <typename T>
+struct LetterCodes {
+  enum { tableLen = Simd<T>::tableLen };
+
+  std::vector<uchar> reversedCodes;
+  std::vector<T> tables;  // [letter * tableLen + code]
+
+  // This leaves reversedCodes empty if the alphabet is too big, or
+  // there is no permute
+  LetterCodes(const uchar *seqBeg, const uchar *seqEnd,
+              const T *const *likelihoodRatioMatrix) {
+    if (tableLen == 0) return;
+    int codes[256];
+    std::fill_n(codes, 256, -1);
+    for (const uchar *s = seqBeg; s < seqEnd; ++s) codes[*s] = 0;
+    std::vector<int> letters;
+    for (int x = 0; x < 256; ++x) {
+      if (codes[x] < 0) continue;
+      if (int(letters.size()) == tableLen) return;
+      codes[x] = letters.size();
+      letters.push_back(x);
+    }
+    if (letters.empty()) return;
+
+    reversedCodes.resize(seqEnd - seqBeg);
+    uchar *r = BEG(reversedCodes);
+    for (const uchar *s = seqEnd; s > seqBeg; ++r) *r = codes[*--s];
+
+    tables.assign((letters.back() + 1) * tableLen, 0);
+    for (size_t i = 0; i < letters.size(); ++i)
+      for (size_t j = 0; j < letters.size(); ++j)
+        tables[letters[i] * tableLen + j] =
+          likelihoodRatioMatrix[letters[i]][letters[j]];
+  }
+};
+
+// The forward and backward algorithms, calculated with floating-point
+// type T.  Single precision (float) has less exponent range, so it
+// rescales more often.
+
+template <typename T>
 struct Tantan {
-  enum { scaleStepSize = 16 };
+  typedef Simd<T> S;
+  typedef typename S::V V;
+
+  enum { scaleStepSize = sizeof(T) < sizeof(double) ? 8 : 16 };
 
   const uchar *seqBeg;  // start of the sequence
   const uchar *seqEnd;  // end of the sequence
@@ -49,39 +321,45 @@ struct Tantan {
 
   int maxRepeatOffset;
 
-  const const_double_ptr *likelihoodRatioMatrix;
-
-  double b2b;  // transition probability from background to background
-  double f2b;  // transition probability from foreground to background
-  double g2g;  // transition probability from gap/indel to gap/indel
-  //double f2g;  // transition probability from foreground to gap/indel
-  //double g2f;  // transition probability from gap/indel to foreground
-  double oneGapProb;  // f2g * g2f
-  double endGapProb;  // f2g * 1
-  double f2f0;  // foreground to foreground, if there are 0 indel transitions
-  double f2f1;  // foreground to foreground, if there is 1 indel transition
-  double f2f2;  // foreground to foreground, if there are 2 indel transitions
-  double b2fDecay;
-  double b2fGrowth;
-  double b2fFirst;  // background state to first foreground state
-  double b2fLast;  // background state to last foreground state
-
-  double backgroundProb;
-  std::vector<double> b2fProbs;  // background state to each foreground state
-  std::vector<double> foregroundProbs;
-  std::vector<double> insertionProbs;
-
-  std::vector<double> scaleFactors;
+  const T *const *likelihoodRatioMatrix;
+
+  T b2b;  // transition probability from background to background
+  T f2b;  // transition probability from foreground to background
+  T g2g;  // transition probability from gap/indel to gap/indel
+  //T f2g;  // transition probability from foreground to gap/indel
+  //T g2f;  // transition probability from gap/indel to foreground
+  T oneGapProb;  // f2g * g2f
+  T endGapProb;  // f2g * 1
+  T f2f0;  // foreground to foreground, if there are 0 indel transitions
+  T f2f1;  // foreground to foreground, if there is 1 indel transition
+  T f2f2;  // foreground to foreground, if there are 2 indel transitions
+  T b2fDecay;
+  T b2fGrowth;
+  T b2fFirst;  // background state to first foreground state
+  T b2fLast;  // background state to last foreground state
+
+  T backgroundProb;
+  std::vector<T> b2fProbs;  // background state to each foreground state
+  std::vector<T> foregroundProbs;
+  std::vector<T> insertionProbs;
+  std::vector<T> gapScratch;  // for calcSuffixGapSums etc.
+  std::vector<T> gapPowers;  // g2g^0, g2g^1, ..., g2g^S::len
+
+  T *scaleFactors;  // space for (seqEnd - seqBeg) / scaleStepSize items
+
+  const uchar *reversedCodesEnd;  // null, or see LetterCodes
+  const T *codeTables;
 
   Tantan(const uchar *seqBeg,
          const uchar *seqEnd,
          int maxRepeatOffset,
-         const const_double_ptr *likelihoodRatioMatrix,
+         const T *const *likelihoodRatioMatrix,
          double repeatProb,
          double repeatEndProb,
          double repeatOffsetProbDecay,
          double firstGapProb,
-         double otherGapProb) {
+         double otherGapProb,
+         T *scaleFactors) {
     assert(maxRepeatOffset > 0);
     assert(repeatProb >= 0 && repeatProb < 1);
     // (if repeatProb==1, then any sequence is impossible)
@@ -96,6 +374,9 @@ struct Tantan {
     this->seqPtr = seqBeg;
     this->maxRepeatOffset = maxRepeatOffset;
     this->likelihoodRatioMatrix = likelihoodRatioMatrix;
+    this->scaleFactors = scaleFactors;
+    this->reversedCodesEnd = 0;
+    this->codeTables = 0;
 
     b2b = 1 - repeatProb;
     f2b = repeatEndProb;
@@ -118,13 +399,47 @@ struct Tantan {
     foregroundProbs.resize(maxRepeatOffset);
     insertionProbs.resize(maxRepeatOffset - 1);
 
+    // Flush probabilities below the normal range to zero, because
+    // denormal arithmetic is slow, and they are negligible anyway
     double p = b2fFirst;
     for (int i = 0; i < maxRepeatOffset; ++i) {
-      b2fProbs[i] = p;
-      p *= b2fDecay;
+      b2fProbs[i] = (p < std::numeric_limits<T>::min()) ? 0 : p;
+      p *= repeatOffsetProbDecay;
+    }
+
+    if (endGapProb > 0) {
+      gapScratch.resize((maxRepeatOffset + gapPad * 2) * 2);
+      gapPowers.resize(S::len + 1);
+      // Negligible powers are zeroed, else they make denormal
+      // numbers (especially in single precision, with 16 lanes)
+      double tiny = std::sqrt(std::numeric_limits<T>::min());
+      double p = 1;
+      for (int i = 0; i <= S::len; ++i) {
+	gapPowers[i] = (p < tiny) ? 0 : p;
+	p *= otherGapProb;
+      }
     }
+  }
+
+  // Uses c (if it isn't empty) for the emission probabilities.  c
+  // must stay alive while this is used.
+  void setLetterCodes(const LetterCodes<T> &c) {
+    if (c.reversedCodes.empty()) return;
+    reversedCodesEnd = END(c.reversedCodes);
+    codeTables = BEG(c.tables);
+  }
+
+  // The codes of the letters before seqPtr, nearest first, or null
+  const uchar *codesBefore() const {
+    return reversedCodesEnd ? reversedCodesEnd - (seqPtr - seqBeg) : 0;
+  }
 
-    scaleFactors.resize((seqEnd - seqBeg) / scaleStepSize);
+  // The likelihood ratios for the letters i+1, i+2, etc. before
+  // seqPtr, one per lane.  table is this letter's LetterCodes table.
+  V likelihoodRatios(const T *lrRow, const T *table, const uchar *codes,
+                     int i) const {
+    return codes ? S::lookup(table, codes + i)
+      :            S::gatherBack(lrRow, seqPtr - i);
   }
 
   void initializeForwardAlgorithm() {
@@ -133,10 +448,10 @@ struct Tantan {
     std::fill(insertionProbs.begin(), insertionProbs.end(), 0.0);
   }
 
-  double forwardTotal() {
-    double fromForeground = std::accumulate(foregroundProbs.begin(),
-                                            foregroundProbs.end(), 0.0);
-    double total = backgroundProb * b2b + fromForeground * f2b;
+  T forwardTotal() {
+    T fromForeground = std::accumulate(foregroundProbs.begin(),
+                                       foregroundProbs.end(), T(0));
+    T total = backgroundProb * b2b + fromForeground * f2b;
     assert(total > 0);
     return total;
   }
@@ -147,132 +462,189 @@ struct Tantan {
     std::fill(insertionProbs.begin(), insertionProbs.end(), 0.0);
   }
 
-  double backwardTotal() {
+  T backwardTotal() {
     assert(backgroundProb > 0);
     return backgroundProb;
   }
 
-  void calcForwardTransitionProbsWithGaps() {
-    double fromBackground = backgroundProb * b2fLast;
-    double *foregroundPtr = &foregroundProbs.back();
-    double f = *foregroundPtr;
-    double fromForeground = f;
-
-    double *insertionPtr = &insertionProbs.back();
-    double i = *insertionPtr;
-    *foregroundPtr = fromBackground + f * f2f1 + i * endGapProb;
-    double d = f;
-    --foregroundPtr;
-    fromBackground *= b2fGrowth;
-
-    while (foregroundPtr > &foregroundProbs.front()) {
-      f = *foregroundPtr;
-      fromForeground += f;
-      i = *(insertionPtr - 1);
-      *foregroundPtr = fromBackground + f * f2f2 + (i + d) * oneGapProb;
-      *insertionPtr = f + i * g2g;
-      d = f + d * g2g;
-      --foregroundPtr;
-      --insertionPtr;
-      fromBackground *= b2fGrowth;
-    }
+  // The gapped algorithms need sums like d[k] = f[k] + g2g * d[k+1].
+  // To do these sums with SIMD, we copy f into the middle of a
+  // zero-padded array x, then get S::len sums at once:
+  // d[k..k+L-1] = sum over m<L of g2g^m * x[k+m..k+m+L-1]
+  //               + g2g^L * d[k+L..k+2L-1],
+  // where L = S::len.  Likewise for the reverse direction.
 
-    f = *foregroundPtr;
-    fromForeground += f;
-    *foregroundPtr = fromBackground + f * f2f1 + d * endGapProb;
-    *insertionPtr = f;
+  enum { gapPad = S::len };
 
-    backgroundProb = backgroundProb * b2b + fromForeground * f2b;
-  }
+  T *gapSumInput() { return BEG(gapScratch) + gapPad; }
 
-  void calcBackwardTransitionProbsWithGaps() {
-    double toBackground = f2b * backgroundProb;
-    double *foregroundPtr = &foregroundProbs.front();
-    double f = *foregroundPtr;
-    double toForeground = f;
-
-    double *insertionPtr = &insertionProbs.front();
-    double i = *insertionPtr;
-    *foregroundPtr = toBackground + f2f1 * f + i;
-    double d = endGapProb * f;
-    ++foregroundPtr;
-    toForeground *= b2fGrowth;
+  T *gapSumOutput() {
+    return BEG(gapScratch) + maxRepeatOffset + gapPad * 3;
+  }
 
-    while (foregroundPtr < &foregroundProbs.back()) {
-      f = *foregroundPtr;
-      toForeground += f;
-      i = *(insertionPtr + 1);
-      *foregroundPtr = toBackground + f2f2 * f + (i + d);
-      double oneGapProb_f = oneGapProb * f;
-      *insertionPtr = oneGapProb_f + g2g * i;
-      d = oneGapProb_f + g2g * d;
-      ++foregroundPtr;
-      ++insertionPtr;
-      toForeground *= b2fGrowth;
+  // Sets gapSumOutput()[k] = sum over j>=k of g2g^(j-k) * gapSumInput()[j]
+  void calcSuffixGapSums() {
+    const T *x = gapSumInput();
+    T *y = gapSumOutput();
+    int k = maxRepeatOffset - S::len;
+    V gLV = S::fill(gapPowers[S::len]);
+    V yV = S::zero();
+    for (; k >= 0; k -= S::len) {
+      V sV = S::load(x + k);
+      for (int m = 1; m < S::len; ++m)
+	sV = S::add(sV, S::mul(S::fill(gapPowers[m]), S::load(x + k + m)));
+      yV = S::add(sV, S::mul(gLV, yV));
+      S::store(y + k, yV);
     }
-
-    f = *foregroundPtr;
-    toForeground += f;
-    *foregroundPtr = toBackground + f2f1 * f + d;
-    *insertionPtr = endGapProb * f;
-
-    backgroundProb = b2b * backgroundProb + b2fLast * toForeground;
+    for (k += S::len - 1; k >= 0; --k) y[k] = x[k] + g2g * y[k + 1];
   }
 
-  void calcForwardTransitionProbs() {
-    if (endGapProb > 0) return calcForwardTransitionProbsWithGaps();
+  // Sets gapSumOutput()[k] = sum over j<=k of g2g^(k-j) * gapSumInput()[j]
+  void calcPrefixGapSums() {
+    const T *x = gapSumInput();
+    T *y = gapSumOutput();
+    int k = 0;
+    V gLV = S::fill(gapPowers[S::len]);
+    V yV = S::zero();
+    for (; k <= maxRepeatOffset - S::len; k += S::len) {
+      V sV = S::load(x + k);
+      for (int m = 1; m < S::len; ++m)
+	sV = S::add(sV, S::mul(S::fill(gapPowers[m]), S::load(x + k - m)));
+      yV = S::add(sV, S::mul(gLV, yV));
+      S::store(y + k, yV);
+    }
+    for (; k < maxRepeatOffset; ++k) y[k] = x[k] + g2g * y[k - 1];
+  }
 
-    double b = backgroundProb;
-    double fromForeground = 0;
-    double *foregroundBeg = BEG(foregroundProbs);
+  void calcForwardTransitionProbsWithGaps() {
+    T b = backgroundProb;
+    const T *b2f = BEG(b2fProbs);
+    T *fp = BEG(foregroundProbs);
+    T *ip = BEG(insertionProbs);
+    T *x = gapSumInput();
+    const T *d = gapSumOutput();
+    int w = maxRepeatOffset;
+
+    V sV = S::zero();
+    int k = 0;
+    for (; k <= w - S::len; k += S::len) {
+      V fV = S::load(fp + k);
+      sV = S::add(sV, fV);
+      S::store(x + k, fV);
+    }
+    T fromForeground = S::sum(sV);
+    for (; k < w; ++k) {
+      fromForeground += fp[k];
+      x[k] = fp[k];
+    }
 
-    for (int i = 0; i < maxRepeatOffset; ++i) {
-      double f = foregroundBeg[i];
-      fromForeground += f;
-      foregroundBeg[i] = b * b2fProbs[i] + f * f2f0;
+    calcSuffixGapSums();
+
+    T fLast = fp[w - 1];
+    T fFirst = fp[0];
+    T iLast = ip[w - 2];
+
+    // Do the middle states, from high to low offsets, so that we use
+    // the old insertion probabilities before overwriting them
+    V bV = S::fill(b);
+    V t2V = S::fill(f2f2);
+    V gV = S::fill(g2g);
+    V oV = S::fill(oneGapProb);
+    k = w - 1 - S::len;
+    for (; k >= 1; k -= S::len) {
+      V fV = S::load(fp + k);
+      V iV = S::load(ip + k - 1);
+      V gapV = S::mul(S::add(iV, S::load(d + k + 1)), oV);
+      V xV = S::mul(bV, S::load(b2f + k));
+      S::store(fp + k, S::add(S::add(xV, S::mul(fV, t2V)), gapV));
+      S::store(ip + k, S::add(fV, S::mul(iV, gV)));
+    }
+    for (k += S::len - 1; k >= 1; --k) {
+      T f = fp[k];
+      T i = ip[k - 1];
+      fp[k] = b * b2f[k] + f * f2f2 + (i + d[k + 1]) * oneGapProb;
+      ip[k] = f + i * g2g;
     }
 
+    fp[w - 1] = b * b2f[w - 1] + fLast * f2f1 + iLast * endGapProb;
+    fp[0] = b * b2f[0] + fFirst * f2f1 + d[1] * endGapProb;
+    ip[0] = fFirst;
+
     backgroundProb = b * b2b + fromForeground * f2b;
   }
 
-  void calcBackwardTransitionProbs() {
-    if (endGapProb > 0) return calcBackwardTransitionProbsWithGaps();
-
-    double toBackground = f2b * backgroundProb;
-    double toForeground = 0;
-    double *foregroundBeg = BEG(foregroundProbs);
-
-    for (int i = 0; i < maxRepeatOffset; ++i) {
-      double f = foregroundBeg[i];
-      toForeground += b2fProbs[i] * f;
-      foregroundBeg[i] = toBackground + f2f0 * f;
+  // If isCounting, this also adds the expected numbers of
+  // background -> foreground transitions to fgCounts: see
+  // countTransitions
+  template <bool isCounting>
+  void calcBackwardTransitionProbsWithGaps(T *fgCounts, T countScale) {
+    T toBackground = f2b * backgroundProb;
+    const T *b2f = BEG(b2fProbs);
+    T *fp = BEG(foregroundProbs);
+    T *ip = BEG(insertionProbs);
+    T *x = gapSumInput();
+    const T *d = gapSumOutput();
+    int w = maxRepeatOffset;
+
+    V oV = S::fill(oneGapProb);
+    V cV = S::fill(countScale);
+    V sV = S::zero();
+    int k = 0;
+    for (; k <= w - S::len; k += S::len) {
+      V fV = S::load(fp + k);
+      V tV = S::mul(S::load(b2f + k), fV);
+      sV = S::add(sV, tV);
+      if (isCounting)
+	S::store(fgCounts + k, S::add(S::load(fgCounts + k), S::mul(tV, cV)));
+      S::store(x + k, S::mul(oV, fV));
+    }
+    T toForeground = S::sum(sV);
+    for (; k < w; ++k) {
+      T t = b2f[k] * fp[k];
+      toForeground += t;
+      if (isCounting) fgCounts[k] += t * countScale;
+      x[k] = oneGapProb * fp[k];
+    }
+    x[0] = endGapProb * fp[0];
+
+    calcPrefixGapSums();
+
+    T fLast = fp[w - 1];
+    fp[0] = toBackground + f2f1 * fp[0] + ip[0];
+
+    // Do the middle states, from low to high offsets, so that we use
+    // the old insertion probabilities before overwriting them
+    V bV = S::fill(toBackground);
+    V t2V = S::fill(f2f2);
+    V gV = S::fill(g2g);
+    k = 1;
+    for (; k <= w - 1 - S::len; k += S::len) {
+      V fV = S::load(fp + k);
+      V iV = S::load(ip + k);
+      V gapV = S::add(iV, S::load(d + k - 1));
+      S::store(fp + k, S::add(S::add(bV, S::mul(t2V, fV)), gapV));
+      S::store(ip + k - 1, S::add(S::mul(oV, fV), S::mul(gV, iV)));
     }
+    for (; k < w - 1; ++k) {
+      T f = fp[k];
+      T i = ip[k];
+      fp[k] = toBackground + f2f2 * f + (i + d[k - 1]);
+      ip[k - 1] = oneGapProb * f + g2g * i;
+    }
+
+    fp[w - 1] = toBackground + f2f1 * fLast + d[w - 2];
+    ip[w - 2] = endGapProb * fLast;
 
     backgroundProb = b2b * backgroundProb + toForeground;
   }
 
-  void addEndCounts(double forwardProb,
-                    double totalProb,
-                    double *transitionCounts) {
-    double toEnd = forwardProb * b2b / totalProb;
+  void addEndCounts(T forwardProb,
+                    T totalProb,
+                    T *transitionCounts) {
+    T toEnd = forwardProb * b2b / totalProb;
     transitionCounts[0] += toEnd;
   }
 
-  void addTransitionCounts(double forwardProb,
-                           double totalProb,
-                           double *transitionCounts) {
-    double toBg = forwardProb * b2b / totalProb;
-    double toFg = forwardProb * b2fFirst / totalProb;
-
-    transitionCounts[0] += backgroundProb * toBg;
-
-    for (double *i = BEG(foregroundProbs); i < END(foregroundProbs); ++i) {
-      ++transitionCounts;
-      *transitionCounts += *i * toFg;
-      toFg *= b2fDecay;
-    }
-  }
-
   bool isNearSeqBeg() {
     return seqPtr - seqBeg < maxRepeatOffset;
   }
@@ -281,25 +653,43 @@ struct Tantan {
     return isNearSeqBeg() ? (seqPtr - seqBeg) : maxRepeatOffset;
   }
 
-  const uchar *seqFurthestBack() {
-    return isNearSeqBeg() ? seqBeg : seqPtr - maxRepeatOffset;
+#ifdef __AVX512F__
+  // Should we do offsets i to maxOffset-1 with one masked vector?  The
+  // lanes past maxOffset are calculated but not stored.  If the row
+  // is short, the masked store is re-loaded too soon (at the next
+  // sequence position), which stalls, so the scalar loop is faster.
+  bool isMaskedTail(int i, int maxOffset) const {
+    return i < maxOffset && i >= S::len * 3 &&
+      seqPtr - seqBeg >= i + S::len;
   }
+#endif
 
   void calcEmissionProbs() {
-    const double *lrRow = likelihoodRatioMatrix[*seqPtr];
-    const uchar *seqStop = seqFurthestBack();
-    double *foregroundPtr = BEG(foregroundProbs);
-    const uchar *offsetPtr = seqPtr;
+    const T *lrRow = likelihoodRatioMatrix[*seqPtr];
+    const uchar *codes = codesBefore();
+    const T *table = codes ? codeTables + *seqPtr * S::tableLen : 0;
+    T *fp = BEG(foregroundProbs);
+    int maxOffset = maxOffsetInTheSequence();
+    const uchar *sp = seqPtr;
 
-    while (offsetPtr > seqStop) {
-      --offsetPtr;
-      *foregroundPtr *= lrRow[*offsetPtr];
-      ++foregroundPtr;
+    int i = 0;
+    for (; i <= maxOffset - S::len; i += S::len) {
+      V rV = likelihoodRatios(lrRow, table, codes, i);
+      S::store(fp+i, S::mul(S::load(fp+i), rV));
     }
-
-    while (foregroundPtr < END(foregroundProbs)) {
-      *foregroundPtr *= 0;
-      ++foregroundPtr;
+#ifdef __AVX512F__
+    if (isMaskedTail(i, maxOffset)) {
+      typename S::Mask m = S::mask(maxOffset - i);
+      V rV = likelihoodRatios(lrRow, table, codes, i);
+      S::storeMasked(fp+i, S::mul(S::loadMasked(fp+i, m), rV), m);
+      i = maxOffset;
+    }
+#endif
+    for (; i < maxOffset; ++i) {
+      fp[i] *= lrRow[sp[-i-1]];
+    }
+    for (; i < maxRepeatOffset; ++i) {
+      fp[i] *= 0;
     }
   }
 
@@ -310,36 +700,41 @@ struct Tantan {
       return;
     }
 
-    double b = backgroundProb;
-    const double *b2f = BEG(b2fProbs);
-    double *fp = BEG(foregroundProbs);
-    const double *lrRow = likelihoodRatioMatrix[*seqPtr];
+    T b = backgroundProb;
+    const T *b2f = BEG(b2fProbs);
+    T *fp = BEG(foregroundProbs);
+    const T *lrRow = likelihoodRatioMatrix[*seqPtr];
+    const uchar *codes = codesBefore();
+    const T *table = codes ? codeTables + *seqPtr * S::tableLen : 0;
     int maxOffset = maxOffsetInTheSequence();
     const uchar *sp = seqPtr;
 
-    SimdDbl bV = simdFillDbl(b);
-    SimdDbl tV = simdFillDbl(f2f0);
-    SimdDbl sV = simdZeroDbl();
+    V bV = S::fill(b);
+    V tV = S::fill(f2f0);
+    V sV = S::zero();
 
     int i = 0;
-    for (; i <= maxOffset - simdDblLen; i += simdDblLen) {
-      SimdDbl rV = simdSetDbl(
-#if defined __SSE4_1__ || defined __ARM_NEON
-#ifdef __AVX2__
-			      lrRow[sp[-i-4]],
-			      lrRow[sp[-i-3]],
-#endif
-			      lrRow[sp[-i-2]],
-#endif
-			      lrRow[sp[-i-1]]);
-      SimdDbl fV = simdLoadDbl(fp+i);
-      sV = simdAddDbl(sV, fV);
-      SimdDbl xV = simdMulDbl(bV, simdLoadDbl(b2f+i));
-      simdStoreDbl(fp+i, simdMulDbl(simdAddDbl(xV, simdMulDbl(fV, tV)), rV));
+    for (; i <= maxOffset - S::len; i += S::len) {
+      V rV = likelihoodRatios(lrRow, table, codes, i);
+      V fV = S::load(fp+i);
+      sV = S::add(sV, fV);
+      V xV = S::mul(bV, S::load(b2f+i));
+      S::store(fp+i, S::mul(S::add(xV, S::mul(fV, tV)), rV));
+    }
+#ifdef __AVX512F__
+    if (isMaskedTail(i, maxOffset)) {
+      typename S::Mask m = S::mask(maxOffset - i);
+      V rV = likelihoodRatios(lrRow, table, codes, i);
+      V fV = S::loadMasked(fp+i, m);
+      sV = S::add(sV, fV);
+      V xV = S::mul(bV, S::loadMasked(b2f+i, m));
+      S::storeMasked(fp+i, S::mul(S::add(xV, S::mul(fV, tV)), rV), m);
+      i = maxOffset;
     }
-    double fromForeground = simdHorizontalAddDbl(sV);
+#endif
+    T fromForeground = S::sum(sV);
     for (; i < maxOffset; ++i) {
-      double f = fp[i];
+      T f = fp[i];
       fromForeground += f;
       fp[i] = (b * b2f[i] + f * f2f0) * lrRow[sp[-i-1]];
     }
@@ -348,49 +743,68 @@ struct Tantan {
   }
 
   void calcEmissionAndBackwardTransitionProbs() {
+    calcEmissionAndBackwardTransitionProbs<false>(0, 0);
+  }
+
+  template <bool isCounting>
+  void calcEmissionAndBackwardTransitionProbs(T *fgCounts, T countScale) {
     if (endGapProb > 0) {
       calcEmissionProbs();
-      calcBackwardTransitionProbsWithGaps();
+      calcBackwardTransitionProbsWithGaps<isCounting>(fgCounts, countScale);
       return;
     }
 
-    double toBackground = f2b * backgroundProb;
-    const double *b2f = BEG(b2fProbs);
-    double *fp = BEG(foregroundProbs);
-    const double *lrRow = likelihoodRatioMatrix[*seqPtr];
+    T toBackground = f2b * backgroundProb;
+    const T *b2f = BEG(b2fProbs);
+    T *fp = BEG(foregroundProbs);
+    const T *lrRow = likelihoodRatioMatrix[*seqPtr];
+    const uchar *codes = codesBefore();
+    const T *table = codes ? codeTables + *seqPtr * S::tableLen : 0;
     int maxOffset = maxOffsetInTheSequence();
     const uchar *sp = seqPtr;
 
-    SimdDbl bV = simdFillDbl(toBackground);
-    SimdDbl tV = simdFillDbl(f2f0);
-    SimdDbl sV = simdZeroDbl();
+    V bV = S::fill(toBackground);
+    V tV = S::fill(f2f0);
+    V cV = S::fill(countScale);
+    V sV = S::zero();
 
     int i = 0;
-    for (; i <= maxOffset - simdDblLen; i += simdDblLen) {
-      SimdDbl rV = simdSetDbl(
-#if defined __SSE4_1__ || defined __ARM_NEON
-#ifdef __AVX2__
-			      lrRow[sp[-i-4]],
-			      lrRow[sp[-i-3]],
-#endif
-			      lrRow[sp[-i-2]],
-#endif
-			      lrRow[sp[-i-1]]);
-      SimdDbl fV = simdMulDbl(simdLoadDbl(fp+i), rV);
-      sV = simdAddDbl(sV, simdMulDbl(simdLoadDbl(b2f+i), fV));
-      simdStoreDbl(fp+i, simdAddDbl(bV, simdMulDbl(tV, fV)));
+    for (; i <= maxOffset - S::len; i += S::len) {
+      V rV = likelihoodRatios(lrRow, table, codes, i);
+      V fV = S::mul(S::load(fp+i), rV);
+      V xV = S::mul(S::load(b2f+i), fV);
+      sV = S::add(sV, xV);
+      if (isCounting)
+	S::store(fgCounts+i, S::add(S::load(fgCounts+i), S::mul(xV, cV)));
+      S::store(fp+i, S::add(bV, S::mul(tV, fV)));
+    }
+#ifdef __AVX512F__
+    if (isMaskedTail(i, maxOffset)) {
+      typename S::Mask m = S::mask(maxOffset - i);
+      V rV = likelihoodRatios(lrRow, table, codes, i);
+      V fV = S::mul(S::loadMasked(fp+i, m), rV);
+      V xV = S::mul(S::loadMasked(b2f+i, m), fV);
+      sV = S::add(sV, xV);
+      if (isCounting)
+	S::storeMasked(fgCounts+i,
+		       S::add(S::loadMasked(fgCounts+i, m), S::mul(xV, cV)), m);
+      S::storeMasked(fp+i, S::add(bV, S::mul(tV, fV)), m);
+      i = maxOffset;
     }
-    double toForeground = simdHorizontalAddDbl(sV);
+#endif
+    T toForeground = S::sum(sV);
     for (; i < maxOffset; ++i) {
-      double f = fp[i] * lrRow[sp[-i-1]];
-      toForeground += b2f[i] * f;
+      T f = fp[i] * lrRow[sp[-i-1]];
+      T x = b2f[i] * f;
+      toForeground += x;
+      if (isCounting) fgCounts[i] += x * countScale;
       fp[i] = toBackground + f2f0 * f;
     }
 
     backgroundProb = b2b * backgroundProb + toForeground;
   }
 
-  void rescale(double scale) {
+  void rescale(T scale) {
     backgroundProb *= scale;
     multiplyAll(foregroundProbs, scale);
     multiplyAll(insertionProbs, scale);
@@ -399,7 +813,7 @@ struct Tantan {
   void rescaleForward() {
     if ((seqPtr - seqBeg) % scaleStepSize == scaleStepSize - 1) {
       assert(backgroundProb > 0);
-      double scale = 1 / backgroundProb;
+      T scale = 1 / backgroundProb;
       scaleFactors[(seqPtr - seqBeg) / scaleStepSize] = scale;
       rescale(scale);
     }
@@ -407,43 +821,412 @@ struct Tantan {
 
   void rescaleBackward() {
     if ((seqPtr - seqBeg) % scaleStepSize == scaleStepSize - 1) {
-      double scale = scaleFactors[(seqPtr - seqBeg) / scaleStepSize];
+      T scale = scaleFactors[(seqPtr - seqBeg) / scaleStepSize];
       rescale(scale);
     }
   }
 
-  void calcRepeatProbs(float *letterProbs) {
-    initializeForwardAlgorithm();
+  // Without gaps, if the foreground probabilities fit in N vectors,
+  // we keep them in registers from one sequence position to the next,
+  // with N known at compile time, so the loop over them is unrolled.
+  // The lanes past maxRepeatOffset have b2f = 0: so they stay 0 in
+  // the forward algorithm, and don't reach the background in the
+  // backward algorithm.  Their letters must exist, so this needs at
+  // least N * S::len letters before seqPtr.
+
+#if defined __AVX2__ || defined __ARM_NEON
+  enum { maxRowVectors = 16 };
+#else
+  enum { maxRowVectors = 8 };
+#endif
 
-    while (seqPtr < seqEnd) {
+  int numOfRowVectors() const {
+    int n = (maxRepeatOffset + S::len - 1) / S::len;
+    return (endGapProb > 0 || n > maxRowVectors) ? 0 : n;
+  }
+
+  template <int N> void loadRow(V *f, V *b2f) const {
+    T x[N * S::len];
+    std::fill_n(x, N * S::len, T(0));
+    std::copy(b2fProbs.begin(), b2fProbs.end(), x);
+    for (int k = 0; k < N; ++k) b2f[k] = S::load(x + k * S::len);
+    std::copy(foregroundProbs.begin(), foregroundProbs.end(), x);
+    for (int k = 0; k < N; ++k) f[k] = S::load(x + k * S::len);
+  }
+
+  template <int N> void storeRow(const V *f) {
+    T x[N * S::len];
+    for (int k = 0; k < N; ++k) S::store(x + k * S::len, f[k]);
+    std::copy(x, x + maxRepeatOffset, foregroundProbs.begin());
+  }
+
+  template <int N>
+  void calcForwardProbsInRegisters(const uchar *end, float *letterProbs) {
+    V f[N], b2f[N];
+    loadRow<N>(f, b2f);
+    T b = backgroundProb;
+    V tV = S::fill(f2f0);
+
+    for (; seqPtr < end; ++seqPtr) {
+      const T *lrRow = likelihoodRatioMatrix[*seqPtr];
+      const uchar *codes = codesBefore();
+      const T *table = codes ? codeTables + *seqPtr * S::tableLen : 0;
+      V bV = S::fill(b);
+      V sV = S::zero();
+      for (int k = 0; k < N; ++k) {
+	V rV = likelihoodRatios(lrRow, table, codes, k * S::len);
+	sV = S::add(sV, f[k]);
+	f[k] = S::mul(S::add(S::mul(bV, b2f[k]), S::mul(f[k], tV)), rV);
+      }
+      b = b * b2b + S::sum(sV) * f2b;
+      if ((seqPtr - seqBeg) % scaleStepSize == scaleStepSize - 1) {
+	assert(b > 0);
+	T scale = 1 / b;
+	scaleFactors[(seqPtr - seqBeg) / scaleStepSize] = scale;
+	b *= scale;
+	V scaleV = S::fill(scale);
+	for (int k = 0; k < N; ++k) f[k] = S::mul(f[k], scaleV);
+      }
+      letterProbs[seqPtr - seqBeg] = static_cast<float>(b);
+    }
+
+    backgroundProb = b;
+    storeRow<N>(f);
+  }
+
+  template <int N>
+  void calcBackwardProbsInRegisters(const uchar *beg, float *letterProbs,
+				    T z) {
+    V f[N], b2f[N];
+    loadRow<N>(f, b2f);
+    T b = backgroundProb;
+    V tV = S::fill(f2f0);
+
+    while (seqPtr > beg) {
+      --seqPtr;
+      float *letterProb = letterProbs + (seqPtr - seqBeg);
+      T nonRepeatProb = *letterProb * b / z;
+      *letterProb = 1 - static_cast<float>(nonRepeatProb);
+      if ((seqPtr - seqBeg) % scaleStepSize == scaleStepSize - 1) {
+	T scale = scaleFactors[(seqPtr - seqBeg) / scaleStepSize];
+	b *= scale;
+	V scaleV = S::fill(scale);
+	for (int k = 0; k < N; ++k) f[k] = S::mul(f[k], scaleV);
+      }
+      const T *lrRow = likelihoodRatioMatrix[*seqPtr];
+      const uchar *codes = codesBefore();
+      const T *table = codes ? codeTables + *seqPtr * S::tableLen : 0;
+      V bV = S::fill(f2b * b);
+      V sV = S::zero();
+      for (int k = 0; k < N; ++k) {
+	V rV = likelihoodRatios(lrRow, table, codes, k * S::len);
+	V fV = S::mul(f[k], rV);
+	sV = S::add(sV, S::mul(b2f[k], fV));
+	f[k] = S::add(bV, S::mul(tV, fV));
+      }
+      b = b2b * b + S::sum(sV);
+    }
+
+    backgroundProb = b;
+    storeRow<N>(f);
+  }
+
+  // Calls the above with N = n, for n <= M
+  template <int M>
+  void calcForwardProbsInRegisters(int n, const uchar *end,
+				   float *letterProbs) {
+    if (n < M)
+      calcForwardProbsInRegisters<(M > 1 ? M - 1 : 1)>(n, end, letterProbs);
+    else
+      calcForwardProbsInRegisters<M>(end, letterProbs);
+  }
+
+  template <int M>
+  void calcBackwardProbsInRegisters(int n, const uchar *beg,
+				    float *letterProbs, T z) {
+    if (n < M)
+      calcBackwardProbsInRegisters<(M > 1 ? M - 1 : 1)>(n, beg, letterProbs,
+							 z);
+    else
+      calcBackwardProbsInRegisters<M>(beg, letterProbs, z);
+  }
+
+  // Does the forward algorithm from seqPtr to end, and puts the
+  // background probabilities in letterProbs (indexed from seqBeg)
+  void calcForwardProbs(const uchar *end, float *letterProbs) {
+    int n = numOfRowVectors();
+    const uchar *mid = n ? std::min(end, seqBeg + n * S::len) : end;
+    while (seqPtr < mid) {
       calcForwardTransitionAndEmissionProbs();
       rescaleForward();
-      *letterProbs = static_cast<float>(backgroundProb);
-      ++letterProbs;
+      letterProbs[seqPtr - seqBeg] = static_cast<float>(backgroundProb);
       ++seqPtr;
     }
+    if (seqPtr < end)
+      calcForwardProbsInRegisters<maxRowVectors>(n, end, letterProbs);
+  }
 
-    double z = forwardTotal();
-
-    initializeBackwardAlgorithm();
-
-    while (seqPtr > seqBeg) {
+  // Does the backward algorithm from seqPtr back to beg, and turns
+  // the forward background probabilities in letterProbs into repeat
+  // probabilities.  z is the sum over states of forward * backward
+  // probabilities, which is the same at every position.
+  void calcBackwardProbs(const uchar *beg, float *letterProbs, T z) {
+    int n = numOfRowVectors();
+    const uchar *mid = std::max(beg, seqBeg + n * S::len);
+    if (n && seqPtr > mid)
+      calcBackwardProbsInRegisters<maxRowVectors>(n, mid, letterProbs, z);
+    while (seqPtr > beg) {
       --seqPtr;
-      --letterProbs;
-      double nonRepeatProb = *letterProbs * backgroundProb / z;
+      float *letterProb = letterProbs + (seqPtr - seqBeg);
+      T nonRepeatProb = *letterProb * backgroundProb / z;
       // Convert nonRepeatProb to a float, so that it is more likely
       // to be exactly 1 when it should be, e.g. for the 1st letter of
       // a sequence:
-      *letterProbs = 1 - static_cast<float>(nonRepeatProb);
+      *letterProb = 1 - static_cast<float>(nonRepeatProb);
       rescaleBackward();
       calcEmissionAndBackwardTransitionProbs();
     }
+  }
 
-    double z2 = backwardTotal();
+  // The next routines let the forward and backward algorithms run at
+  // the same time, in two threads that meet in the middle.  Then the
+  // backward algorithm can't use the forward scale factors, so it has
+  // its own.  The sum over states of forward * backward probabilities
+  // is then no longer constant: it changes by (forward scale factor /
+  // backward scale factor) at each rescaling position.
+
+  void rescaleBackwardByItself() {
+    if ((seqPtr - seqBeg) % scaleStepSize == scaleStepSize - 1) {
+      assert(backgroundProb > 0);
+      T scale = 1 / backgroundProb;
+      scaleFactors[(seqPtr - seqBeg) / scaleStepSize] = scale;
+      rescale(scale);
+    }
+  }
+
+  // Does the backward algorithm from seqPtr back to beg, and puts the
+  // background probabilities in letterProbs (indexed from seqBeg)
+  void calcBackwardProbsByItself(const uchar *beg, float *letterProbs) {
+    while (seqPtr > beg) {
+      --seqPtr;
+      letterProbs[seqPtr - seqBeg] = static_cast<float>(backgroundProb);
+      rescaleBackwardByItself();
+      calcEmissionAndBackwardTransitionProbs();
+    }
+  }
+
+  // Continues the forward algorithm from seqPtr to end, and turns the
+  // backward background probabilities in letterProbs into repeat
+  // probabilities.  z is the sum over states of forward * backward
+  // probabilities at the position before seqPtr.  Returns z at the
+  // end, which should equal forwardTotal().
+  T calcForwardRepeatProbs(const uchar *end, float *letterProbs,
+                           T z, const T *backwardScales) {
+    while (seqPtr < end) {
+      calcForwardTransitionAndEmissionProbs();
+      if ((seqPtr - seqBeg) % scaleStepSize == scaleStepSize - 1) {
+        size_t k = (seqPtr - seqBeg) / scaleStepSize;
+        rescaleForward();
+        z *= scaleFactors[k] / backwardScales[k];
+      }
+      float *letterProb = letterProbs + (seqPtr - seqBeg);
+      T nonRepeatProb = *letterProb * backgroundProb / z;
+      *letterProb = 1 - static_cast<float>(nonRepeatProb);
+      ++seqPtr;
+    }
+    return z;
+  }
+
+  // Continues the backward algorithm from seqPtr back to beg, and
+  // turns the forward background probabilities in letterProbs into
+  // repeat probabilities.  z is the sum over states of forward *
+  // backward probabilities at the position before seqPtr.  Returns z
+  // at the start, which should equal backwardTotal().
+  T calcBackwardRepeatProbs(const uchar *beg, float *letterProbs,
+                            T z, const T *forwardScales) {
+    while (seqPtr > beg) {
+      --seqPtr;
+      float *letterProb = letterProbs + (seqPtr - seqBeg);
+      T nonRepeatProb = *letterProb * backgroundProb / z;
+      *letterProb = 1 - static_cast<float>(nonRepeatProb);
+      if ((seqPtr - seqBeg) % scaleStepSize == scaleStepSize - 1) {
+        size_t k = (seqPtr - seqBeg) / scaleStepSize;
+        rescaleBackwardByItself();
+        z *= scaleFactors[k] / forwardScales[k];
+      }
+      calcEmissionAndBackwardTransitionProbs();
+    }
+    return z;
+  }
+
+  void calcRepeatProbs(float *letterProbs) {
+    initializeForwardAlgorithm();
+    calcForwardProbs(seqEnd, letterProbs);
+    T z = forwardTotal();
+    initializeBackwardAlgorithm();
+    calcBackwardProbs(seqBeg, letterProbs, z);
+    T z2 = backwardTotal();
     checkForwardAndBackwardTotals(z, z2);
   }
 
-  void countTransitions(double *transitionCounts) {
+  // The complete forward or backward state, as one vector: background,
+  // foreground, insertion (if there are gaps)
+  int numOfStates() const {
+    return 1 + maxRepeatOffset + (endGapProb > 0) * (maxRepeatOffset - 1);
+  }
+
+  void getState(T *state) const {
+    *state++ = backgroundProb;
+    state = std::copy(foregroundProbs.begin(), foregroundProbs.end(), state);
+    if (endGapProb > 0)
+      std::copy(insertionProbs.begin(), insertionProbs.end(), state);
+  }
+
+  void setState(const T *state) {
+    backgroundProb = *state++;
+    std::copy(state, state + maxRepeatOffset, foregroundProbs.begin());
+    state += maxRepeatOffset;
+    if (endGapProb > 0)
+      std::copy(state, state + maxRepeatOffset - 1, insertionProbs.begin());
+    else
+      std::fill(insertionProbs.begin(), insertionProbs.end(), 0.0);
+  }
+
+  // A forward or backward state, which we follow through a chunk of
+  // sequence while calculating the chunk's linear map:
+  struct Column {
+    T backgroundProb;
+    std::vector<T> foregroundProbs;
+    std::vector<T> insertionProbs;
+    bool isFollowed;
+    T ratio;  // to the background column, once proportional to it
+  };
+
+  void swapState(Column &c) {
+    std::swap(backgroundProb, c.backgroundProb);
+    foregroundProbs.swap(c.foregroundProbs);
+    insertionProbs.swap(c.insertionProbs);
+  }
+
+  bool isProportional(const Column &c, const Column &b, T ratio) {
+    const T tolerance = 1e-12;  // far below float precision
+    for (int i = 0; i < maxRepeatOffset; ++i) {
+      T x = b.foregroundProbs[i] * ratio;
+      if (std::abs(c.foregroundProbs[i] - x) > x * tolerance) return false;
+    }
+    for (int i = 0; i < maxRepeatOffset - 1; ++i) {
+      T x = b.insertionProbs[i] * ratio;
+      if (std::abs(c.insertionProbs[i] - x) > x * tolerance) return false;
+    }
+    return true;
+  }
+
+  // Gets the linear map from the forward state before chunkBeg to the
+  // forward state before chunkEnd (or, if !isForward, from the
+  // backward state before chunkEnd to the backward state before
+  // chunkBeg), as a numOfStates x numOfStates column-major matrix.
+  // It is known only up to a constant factor.  The scale factors go
+  // in scaleFactors, as in the normal forward (or backward by itself)
+  // algorithm.
+
+  // To get it, we push each basis vector through the chunk.  Usually,
+  // after a few hundred letters, they all become proportional to the
+  // one for the background state, because the HMM forgets its past.
+  // After that, we only need to follow the background one.  But in a
+  // long, exact, short-period repeat, some may never become
+  // proportional: then we give up (returning false) before following
+  // them costs more than about 2 normal passes through the chunk.
+
+  bool calcChunkMap(const uchar *chunkBeg, const uchar *chunkEnd,
+                    bool isForward, T *matrix) {
+    int n = numOfStates();
+    std::vector<Column> columns(n);
+    std::vector<T> state(n);
+    for (int j = 0; j < n; ++j) {
+      Column &c = columns[j];
+      c.foregroundProbs.resize(maxRepeatOffset);
+      c.insertionProbs.resize(maxRepeatOffset - 1);
+      state[j] = 1;
+      setState(BEG(state));
+      swapState(c);
+      state[j] = 0;
+      c.isFollowed = true;
+    }
+    Column &bgColumn = columns[0];
+    int numOfFollowedColumns = n;
+    double extraWork = 0;
+    double maxExtraWork = std::max(2.0 * (chunkEnd - chunkBeg), 500.0 * n);
+
+    seqPtr = isForward ? chunkBeg : chunkEnd;
+    while (isForward ? seqPtr < chunkEnd : seqPtr > chunkBeg) {
+      extraWork += numOfFollowedColumns - 1;
+      if (extraWork > maxExtraWork) return false;
+      if (!isForward) --seqPtr;
+      for (int j = 0; j < n; ++j) {
+        if (!columns[j].isFollowed) continue;
+        swapState(columns[j]);
+        if (isForward) calcForwardTransitionAndEmissionProbs();
+        else calcEmissionAndBackwardTransitionProbs();
+        swapState(columns[j]);
+      }
+      if ((seqPtr - seqBeg) % scaleStepSize == scaleStepSize - 1) {
+        swapState(bgColumn);
+        if (isForward) rescaleForward();
+        else rescaleBackwardByItself();
+        swapState(bgColumn);
+        T scale = scaleFactors[(seqPtr - seqBeg) / scaleStepSize];
+        for (int j = 1; j < n; ++j) {
+          Column &c = columns[j];
+          if (!c.isFollowed) continue;
+          swapState(c);
+          rescale(scale);
+          swapState(c);
+          T ratio = c.backgroundProb / bgColumn.backgroundProb;
+          if (isProportional(c, bgColumn, ratio)) {
+            c.isFollowed = false;
+            c.ratio = ratio;
+            --numOfFollowedColumns;
+          }
+        }
+      }
+      if (isForward) ++seqPtr;
+      if (numOfFollowedColumns == 1) break;
+    }
+
+    swapState(bgColumn);
+    while (isForward ? seqPtr < chunkEnd : seqPtr > chunkBeg) {
+      if (!isForward) --seqPtr;
+      if (isForward) {
+        calcForwardTransitionAndEmissionProbs();
+        rescaleForward();
+        ++seqPtr;
+      } else {
+        calcEmissionAndBackwardTransitionProbs();
+        rescaleBackwardByItself();
+      }
+    }
+    getState(matrix);
+    swapState(bgColumn);
+
+    for (int j = 1; j < n; ++j) {
+      Column &c = columns[j];
+      T *column = matrix + j * n;
+      if (c.isFollowed) {
+        swapState(c);
+        getState(column);
+        swapState(c);
+      } else {
+        for (int i = 0; i < n; ++i) column[i] = matrix[i] * c.ratio;
+      }
+    }
+    return true;
+  }
+
+  // The expected count of each background -> foreground transition
+  // is: forward background prob * b2f * backward foreground prob /
+  // total.  The backward kernel calculates b2f * backward foreground
+  // prob anyway, so it adds these counts as it goes.
+  void countTransitions(T *transitionCounts) {
     std::vector<float> p(seqEnd - seqBeg);
     float *letterProbs = BEG(p);
 
@@ -451,14 +1234,13 @@ struct Tantan {
 
     while (seqPtr < seqEnd) {
       *letterProbs = static_cast<float>(backgroundProb);
-      calcForwardTransitionProbs();
-      calcEmissionProbs();
+      calcForwardTransitionAndEmissionProbs();
       rescaleForward();
       ++letterProbs;
       ++seqPtr;
     }
 
-    double z = forwardTotal();
+    T z = forwardTotal();
 
     addEndCounts(backgroundProb, z, transitionCounts);
 
@@ -468,16 +1250,328 @@ struct Tantan {
       --seqPtr;
       --letterProbs;
       rescaleBackward();
-      calcEmissionProbs();
-      addTransitionCounts(*letterProbs, z, transitionCounts);
-      calcBackwardTransitionProbs();
+      T countScale = *letterProbs / z;
+      transitionCounts[0] += backgroundProb * b2b * countScale;
+      calcEmissionAndBackwardTransitionProbs<true>(transitionCounts + 1,
+						   countScale);
     }
 
-    double z2 = backwardTotal();
+    T z2 = backwardTotal();
     checkForwardAndBackwardTotals(z, z2);
   }
 };
 
+// This does the forward and backward algorithms for several
+// sequences at once, one per SIMD lane, so that each vector
+// instruction advances every sequence by one position.  This is good
+// for short sequences: the normal algorithm wastes most of each
+// vector near the start of a sequence, where there are few offsets.
+// Only the no-gap algorithm is done this way.
+
+template <typename T>
+struct TantanLanes {
+  typedef Simd<T> S;
+  typedef typename S::V V;
+
+  enum { numOfLanes = S::len };
+  enum { scaleStepSize = Tantan<T>::scaleStepSize };
+
+  const Tantan<T> &model;  // gives the transition probabilities
+
+  size_t seqLengths[numOfLanes];
+  size_t maxLength;
+
+  // For each of these, item [x * numOfLanes + lane] is for that lane:
+  std::vector<uchar> letters;  // x = sequence position
+  std::vector<T> b2fProbs;  // x = offset
+  std::vector<T> foregroundProbs;  // x = offset
+  std::vector<T> scaleFactors;  // x = rescaling step
+  std::vector<float> letterProbs;  // x = sequence position
+
+  T backgroundProbs[numOfLanes];
+  T totals[numOfLanes];
+
+  explicit TantanLanes(const Tantan<T> &t) : model(t) {
+    int w = model.maxRepeatOffset;
+    b2fProbs.resize(w * numOfLanes);
+    for (int i = 0; i < w; ++i)
+      std::fill_n(&b2fProbs[i * numOfLanes], +numOfLanes, model.b2fProbs[i]);
+    foregroundProbs.resize(w * numOfLanes);
+  }
+
+  // Copy the sequences into the lanes.  Missing and finished lanes
+  // are padded with letter 0, so that they calculate harmless
+  // numbers.
+  void setSequences(const uchar *const *seqBegs, const uchar *const *seqEnds,
+                    int numOfSequences) {
+    maxLength = 0;
+    for (int j = 0; j < numOfLanes; ++j) {
+      seqLengths[j] = (j < numOfSequences) ? seqEnds[j] - seqBegs[j] : 0;
+      maxLength = std::max(maxLength, seqLengths[j]);
+    }
+    letters.assign(maxLength * numOfLanes, 0);
+    for (int j = 0; j < numOfSequences; ++j)
+      for (size_t k = 0; k < seqLengths[j]; ++k)
+        letters[k * numOfLanes + j] = seqBegs[j][k];
+    scaleFactors.resize(maxLength / scaleStepSize * numOfLanes);
+    letterProbs.resize(maxLength * numOfLanes);
+  }
+
+  // Lane j gets lrRows[j][s[j]]
+  static V emissionProbs(const T *const *lrRows, const uchar *s) {
+    return S::gatherRows(lrRows, s);
+  }
+
+  const uchar *getRows(size_t position, const T **lrRows) const {
+    const uchar *s = &letters[position * numOfLanes];
+    for (int j = 0; j < numOfLanes; ++j)
+      lrRows[j] = model.likelihoodRatioMatrix[s[j]];
+    return s;
+  }
+
+  int maxOffset(size_t position) const {
+    return std::min(position, size_t(model.maxRepeatOffset));
+  }
+
+  void rescale(const T *scales) {
+    V sV = S::load(scales);
+    S::store(backgroundProbs, S::mul(S::load(backgroundProbs), sV));
+    for (size_t i = 0; i < foregroundProbs.size(); i += numOfLanes) {
+      T *fp = &foregroundProbs[i];
+      S::store(fp, S::mul(S::load(fp), sV));
+    }
+  }
+
+  void calcForwardTransitionAndEmissionProbs(size_t position) {
+    const T *lrRows[numOfLanes];
+    const uchar *sp = getRows(position, lrRows);
+    int w = maxOffset(position);
+    const T *b2f = BEG(b2fProbs);
+    T *fp = BEG(foregroundProbs);
+
+    V bV = S::load(backgroundProbs);
+    V tV = S::fill(model.f2f0);
+    V sV = S::zero();
+
+    for (int i = 0; i < w; ++i) {
+      int k = i * numOfLanes;
+      V rV = emissionProbs(lrRows, sp - k - numOfLanes);
+      V fV = S::load(fp + k);
+      sV = S::add(sV, fV);
+      V xV = S::mul(bV, S::load(b2f + k));
+      S::store(fp + k, S::mul(S::add(xV, S::mul(fV, tV)), rV));
+    }
+
+    V b2bV = S::fill(model.b2b);
+    V f2bV = S::fill(model.f2b);
+    S::store(backgroundProbs, S::add(S::mul(bV, b2bV), S::mul(sV, f2bV)));
+  }
+
+  void calcEmissionAndBackwardTransitionProbs(size_t position) {
+    const T *lrRows[numOfLanes];
+    const uchar *sp = getRows(position, lrRows);
+    int w = maxOffset(position);
+    const T *b2f = BEG(b2fProbs);
+    T *fp = BEG(foregroundProbs);
+
+    V b2bV = S::fill(model.b2b);
+    V bV = S::mul(S::fill(model.f2b), S::load(backgroundProbs));
+    V tV = S::fill(model.f2f0);
+    V sV = S::zero();
+
+    for (int i = 0; i < w; ++i) {
+      int k = i * numOfLanes;
+      V rV = emissionProbs(lrRows, sp - k - numOfLanes);
+      V fV = S::mul(S::load(fp + k), rV);
+      sV = S::add(sV, S::mul(S::load(b2f + k), fV));
+      S::store(fp + k, S::add(bV, S::mul(tV, fV)));
+    }
+
+    S::store(backgroundProbs,
+             S::add(S::mul(b2bV, S::load(backgroundProbs)), sV));
+  }
+
+  bool isScalingPosition(size_t position) const {
+    return position % scaleStepSize == scaleStepSize - 1;
+  }
+
+  T *scalesAt(size_t position) {
+    return &scaleFactors[position / scaleStepSize * numOfLanes];
+  }
+
+  void calcForwardProbs() {
+    std::fill_n(backgroundProbs, +numOfLanes, T(1));
+    std::fill(foregroundProbs.begin(), foregroundProbs.end(), T(0));
+    std::fill_n(totals, +numOfLanes, model.b2b);
+
+    for (size_t p = 0; p < maxLength; ++p) {
+      calcForwardTransitionAndEmissionProbs(p);
+      if (isScalingPosition(p)) {
+        T *scales = scalesAt(p);
+        for (int j = 0; j < numOfLanes; ++j) {
+          assert(backgroundProbs[j] > 0);
+          scales[j] = 1 / backgroundProbs[j];
+        }
+        rescale(scales);
+      }
+      for (int j = 0; j < numOfLanes; ++j) {
+        letterProbs[p * numOfLanes + j] =
+          static_cast<float>(backgroundProbs[j]);
+        if (p + 1 == seqLengths[j]) totals[j] = forwardTotal(j);
+      }
+    }
+  }
+
+  T forwardTotal(int lane) const {
+    T fromForeground = 0;
+    for (size_t i = lane; i < foregroundProbs.size(); i += numOfLanes)
+      fromForeground += foregroundProbs[i];
+    return backgroundProbs[lane] * model.b2b + fromForeground * model.f2b;
+  }
+
+  void initializeBackwardAlgorithm(int lane) {
+    backgroundProbs[lane] = model.b2b;
+    for (size_t i = lane; i < foregroundProbs.size(); i += numOfLanes)
+      foregroundProbs[i] = model.f2b;
+  }
+
+  void calcBackwardProbs() {
+    for (size_t p = maxLength; p-- > 0; ) {
+      for (int j = 0; j < numOfLanes; ++j) {
+        if (p + 1 == seqLengths[j]) initializeBackwardAlgorithm(j);
+        if (p >= seqLengths[j]) continue;
+        float *letterProb = &letterProbs[p * numOfLanes + j];
+        T nonRepeatProb = *letterProb * backgroundProbs[j] / totals[j];
+        *letterProb = 1 - static_cast<float>(nonRepeatProb);
+      }
+      if (isScalingPosition(p)) rescale(scalesAt(p));
+      calcEmissionAndBackwardTransitionProbs(p);
+    }
+
+    for (int j = 0; j < numOfLanes; ++j)
+      if (seqLengths[j] > 0)
+        checkForwardAndBackwardTotals(totals[j], backgroundProbs[j]);
+  }
+
+  void getRepeatProbs(float *const *probabilities, int numOfSequences) const {
+    for (int j = 0; j < numOfSequences; ++j)
+      for (size_t k = 0; k < seqLengths[j]; ++k)
+        probabilities[j][k] = letterProbs[k * numOfLanes + j];
+  }
+};
+
+static bool isSinglePrecision = false;
+
+// A compact copy of the likelihood ratio matrix, for the letters that
+// occur in some sequences.  The caller's matrix is often 64 x 64
+// doubles, the whole L1 cache, though only 4 or 25 letters are used.
+// The rows are padded and aligned to cache lines.
+template <typename T>
+struct CompactMatrix {
+  enum { lineLen = 64 / sizeof(T) };
+
+  std::vector<T> values;
+  std::vector<const T *> rows;
+
+  CompactMatrix(const const_double_ptr *likelihoodRatioMatrix,
+                const uchar *const *seqBegs, const uchar *const *seqEnds,
+                size_t numOfSequences) {
+    int n = 1;
+    for (size_t i = 0; i < numOfSequences; ++i)
+      for (const uchar *s = seqBegs[i]; s < seqEnds[i]; ++s)
+        n = std::max(n, *s + 1);
+    int rowSize = (n + lineLen - 1) / lineLen * lineLen;
+    values.resize(n * rowSize + lineLen);
+    T *v = BEG(values);
+    v += (lineLen - reinterpret_cast<size_t>(v) / sizeof(T) % lineLen) %
+      lineLen;
+    rows.resize(n);
+    for (int i = 0; i < n; ++i) {
+      std::copy(likelihoodRatioMatrix[i], likelihoodRatioMatrix[i] + n,
+                v + i * rowSize);
+      rows[i] = v + i * rowSize;
+    }
+  }
+};
+
+template <typename T>
+void calcRepeatProbs(const uchar *seqBeg,
+                     const uchar *seqEnd,
+                     int maxRepeatOffset,
+                     const T *const *likelihoodRatioMatrix,
+                     double repeatProb,
+                     double repeatEndProb,
+                     double repeatOffsetProbDecay,
+                     double firstGapProb,
+                     double otherGapProb,
+                     float *probabilities) {
+  std::vector<T> scaleFactors((seqEnd - seqBeg) / Tantan<T>::scaleStepSize);
+  Tantan<T> tantan(seqBeg, seqEnd, maxRepeatOffset, likelihoodRatioMatrix,
+                   repeatProb, repeatEndProb, repeatOffsetProbDecay,
+                   firstGapProb, otherGapProb, BEG(scaleFactors));
+  LetterCodes<T> codes(seqBeg, seqEnd, likelihoodRatioMatrix);
+  tantan.setLetterCodes(codes);
+  tantan.calcRepeatProbs(probabilities);
+}
+
+template <typename T>
+void calcRepeatProbsOfSequences(const uchar *const *seqBegs,
+                                const uchar *const *seqEnds,
+                                size_t numOfSequences,
+                                int maxRepeatOffset,
+                                const T *const *likelihoodRatioMatrix,
+                                double repeatProb,
+                                double repeatEndProb,
+                                double repeatOffsetProbDecay,
+                                double firstGapProb,
+                                double otherGapProb,
+                                float *const *probabilities) {
+  Tantan<T> model(0, 0, maxRepeatOffset, likelihoodRatioMatrix,
+                  repeatProb, repeatEndProb, repeatOffsetProbDecay,
+                  firstGapProb, otherGapProb, 0);
+
+  if (model.endGapProb > 0) {
+    for (size_t i = 0; i < numOfSequences; ++i)
+      calcRepeatProbs(seqBegs[i], seqEnds[i], maxRepeatOffset,
+                      likelihoodRatioMatrix, repeatProb, repeatEndProb,
+                      repeatOffsetProbDecay, firstGapProb, otherGapProb,
+                      probabilities[i]);
+    return;
+  }
+
+  // Put sequences of similar length in the same group of lanes:
+  std::vector<size_t> order;
+  for (size_t i = 0; i < numOfSequences; ++i)
+    if (seqEnds[i] > seqBegs[i]) order.push_back(i);
+  std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+      return seqEnds[x] - seqBegs[x] < seqEnds[y] - seqBegs[y];
+    });
+
+  TantanLanes<T> lanes(model);
+  const int numOfLanes = TantanLanes<T>::numOfLanes;
+  const uchar *begs[numOfLanes];
+  const uchar *ends[numOfLanes];
+  float *probs[numOfLanes];
+
+  for (size_t i = 0; i < order.size(); i += numOfLanes) {
+    int n = std::min(order.size() - i, size_t(numOfLanes));
+    for (int j = 0; j < n; ++j) {
+      size_t k = order[i + j];
+      begs[j] = seqBegs[k];
+      ends[j] = seqEnds[k];
+      probs[j] = probabilities[k];
+    }
+    lanes.setSequences(begs, ends, n);
+    lanes.calcForwardProbs();
+    lanes.calcBackwardProbs();
+    lanes.getRepeatProbs(probs, n);
+  }
+}
+
+void setSinglePrecision(bool isSingle) {
+  isSinglePrecision = isSingle;
+}
+
 void maskSequences(uchar *seqBeg,
                    uchar *seqEnd,
                    int maxRepeatOffset,
@@ -510,22 +1604,563 @@ void getProbabilities(const uchar *seqBeg,
                       double firstGapProb,
                       double otherGapProb,
                       float *probabilities) {
-  Tantan tantan(seqBeg, seqEnd, maxRepeatOffset, likelihoodRatioMatrix,
-                repeatProb, repeatEndProb, repeatOffsetProbDecay,
-                firstGapProb, otherGapProb);
-  tantan.calcRepeatProbs(probabilities);
+  if (isSinglePrecision) {
+    CompactMatrix<float> m(likelihoodRatioMatrix, &seqBeg, &seqEnd, 1);
+    calcRepeatProbs(seqBeg, seqEnd, maxRepeatOffset, BEG(m.rows),
+                    repeatProb, repeatEndProb, repeatOffsetProbDecay,
+                    firstGapProb, otherGapProb, probabilities);
+  } else {
+    CompactMatrix<double> m(likelihoodRatioMatrix, &seqBeg, &seqEnd, 1);
+    calcRepeatProbs(seqBeg, seqEnd, maxRepeatOffset, BEG(m.rows),
+                    repeatProb, repeatEndProb, repeatOffsetProbDecay,
+                    firstGapProb, otherGapProb, probabilities);
+  }
+}
+
+void getProbabilitiesInWindows(const uchar *seqBeg,
+                               const uchar *seqEnd,
+                               int maxRepeatOffset,
+                               const const_double_ptr *likelihoodRatioMatrix,
+                               double repeatProb,
+                               double repeatEndProb,
+                               double repeatOffsetProbDecay,
+                               double firstGapProb,
+                               double otherGapProb,
+                               float *probabilities,
+                               size_t windowLength,
+                               size_t windowOverlap,
+                               int numOfThreads) {
+  assert(windowLength > 0);
+  size_t seqLen = seqEnd - seqBeg;
+  size_t numOfWindows = (seqLen + windowLength - 1) / windowLength;
+
+  parallelFor(numOfWindows, numOfThreads, [&](size_t w) {
+      std::vector<float> p;
+      size_t beg = w * windowLength;
+      size_t end = std::min(beg + windowLength, seqLen);
+      size_t extBeg = beg - std::min(beg, windowOverlap);
+      size_t extEnd = end + std::min(seqLen - end, windowOverlap);
+      p.resize(extEnd - extBeg);
+      getProbabilities(seqBeg + extBeg, seqBeg + extEnd, maxRepeatOffset,
+                       likelihoodRatioMatrix, repeatProb, repeatEndProb,
+                       repeatOffsetProbDecay, firstGapProb, otherGapProb,
+                       BEG(p));
+      std::copy(BEG(p) + (beg - extBeg), BEG(p) + (end - extBeg),
+                probabilities + beg);
+    });
+}
+
+void getProbabilitiesInChunks(const uchar *seqBeg,
+                              const uchar *seqEnd,
+                              int maxRepeatOffset,
+                              const const_double_ptr *likelihoodRatioMatrix,
+                              double repeatProb,
+                              double repeatEndProb,
+                              double repeatOffsetProbDecay,
+                              double firstGapProb,
+                              double otherGapProb,
+                              float *probabilities,
+                              size_t chunkLength,
+                              int numOfThreads) {
+  assert(chunkLength > 0);
+  size_t seqLen = seqEnd - seqBeg;
+  size_t numOfChunks = (seqLen + chunkLength - 1) / chunkLength;
+  if (numOfChunks < 2)
+    return getProbabilities(seqBeg, seqEnd, maxRepeatOffset,
+                            likelihoodRatioMatrix, repeatProb, repeatEndProb,
+                            repeatOffsetProbDecay, firstGapProb, otherGapProb,
+                            probabilities);
+
+  CompactMatrix<double> m(likelihoodRatioMatrix, &seqBeg, &seqEnd, 1);
+  std::vector<double> scaleFactors(seqLen / Tantan<double>::scaleStepSize);
+  Tantan<double> model(seqBeg, seqEnd, maxRepeatOffset,
+                       BEG(m.rows), repeatProb, repeatEndProb,
+                       repeatOffsetProbDecay, firstGapProb, otherGapProb,
+                       BEG(scaleFactors));
+  LetterCodes<double> codes(seqBeg, seqEnd, BEG(m.rows));
+  model.setLetterCodes(codes);
+  size_t numOfStates = model.numOfStates();
+  size_t matrixSize = numOfStates * numOfStates;
+
+  auto chunkBeg = [&](size_t c) { return seqBeg + c * chunkLength; };
+  auto chunkEnd = [&](size_t c) {
+    return seqBeg + std::min((c + 1) * chunkLength, seqLen);
+  };
+
+  // Get the forward maps of all chunks but the last, and the backward
+  // maps of all chunks but the first.  The forward and backward maps
+  // of one chunk are done at the same time, so they record their
+  // scale factors in different places.  If any map gives up, do the
+  // whole sequence in the normal (serial) way.
+  std::vector<double> maps(2 * (numOfChunks - 1) * matrixSize);
+  std::vector<double> backwardMapScales(scaleFactors.size());
+  std::atomic<bool> isGivenUp(false);
+  parallelFor(2 * (numOfChunks - 1), numOfThreads, [&](size_t k) {
+      if (isGivenUp) return;
+      Tantan<double> tantan(model);
+      bool isForward = (k < numOfChunks - 1);
+      size_t c = isForward ? k : k - (numOfChunks - 1) + 1;
+      if (!isForward) tantan.scaleFactors = BEG(backwardMapScales);
+      if (!tantan.calcChunkMap(chunkBeg(c), chunkEnd(c), isForward,
+                               &maps[k * matrixSize]))
+        isGivenUp = true;
+    });
+  if (isGivenUp)
+    return getProbabilities(seqBeg, seqEnd, maxRepeatOffset,
+                            likelihoodRatioMatrix, repeatProb, repeatEndProb,
+                            repeatOffsetProbDecay, firstGapProb, otherGapProb,
+                            probabilities);
+
+  // Get each chunk's forward state at its start, and backward state
+  // at its end.  This is serial, but each step is just a matrix times
+  // a vector: numOfStates times less work than a chunk map, or than a
+  // step of a parallel prefix, which would multiply the matrices.
+  std::vector<std::vector<double> >
+    starts(numOfChunks, std::vector<double>(numOfStates)),
+    ends(numOfChunks, std::vector<double>(numOfStates));
+  model.initializeForwardAlgorithm();
+  model.getState(BEG(starts[0]));
+  for (size_t c = 1; c < numOfChunks; ++c)
+    multiplyAndNormalize(&maps[(c - 1) * matrixSize], starts[c - 1],
+                         starts[c]);
+  model.initializeBackwardAlgorithm();
+  model.getState(BEG(ends[numOfChunks - 1]));
+  for (size_t c = numOfChunks - 1; c > 0; --c)
+    multiplyAndNormalize(&maps[(numOfChunks - 2 + c) * matrixSize], ends[c],
+                         ends[c - 1]);
+
+  // Now each chunk can do the normal forward and backward algorithms:
+  std::vector<std::vector<double> >
+    forwardEnds(numOfChunks, std::vector<double>(numOfStates));
+  parallelFor(numOfChunks, numOfThreads, [&](size_t c) {
+      Tantan<double> tantan(model);
+      tantan.seqPtr = chunkBeg(c);
+      tantan.setState(BEG(starts[c]));
+      tantan.calcForwardProbs(chunkEnd(c), probabilities);
+      tantan.getState(BEG(forwardEnds[c]));
+    });
+  parallelFor(numOfChunks, numOfThreads, [&](size_t c) {
+      Tantan<double> tantan(model);
+      std::vector<double> state(numOfStates);
+      tantan.seqPtr = chunkEnd(c);
+      tantan.setState(BEG(ends[c]));
+      double z = dotProduct(forwardEnds[c], ends[c]);
+      tantan.calcBackwardProbs(chunkBeg(c), probabilities, z);
+      tantan.getState(BEG(state));
+      double z2 = dotProduct(starts[c], state);
+      checkForwardAndBackwardTotals(z, z2);
+    });
+}
+
+void getProbabilitiesBidirectionally(const uchar *seqBeg,
+                                     const uchar *seqEnd,
+                                     int maxRepeatOffset,
+                                     const const_double_ptr
+                                     *likelihoodRatioMatrix,
+                                     double repeatProb,
+                                     double repeatEndProb,
+                                     double repeatOffsetProbDecay,
+                                     double firstGapProb,
+                                     double otherGapProb,
+                                     float *probabilities) {
+  size_t numOfScaleFactors =
+    (seqEnd - seqBeg) / Tantan<double>::scaleStepSize;
+  std::vector<double> forwardScales(numOfScaleFactors);
+  std::vector<double> backwardScales(numOfScaleFactors);
+  CompactMatrix<double> m(likelihoodRatioMatrix, &seqBeg, &seqEnd, 1);
+  Tantan<double> f(seqBeg, seqEnd, maxRepeatOffset,
+                   BEG(m.rows), repeatProb, repeatEndProb,
+                   repeatOffsetProbDecay, firstGapProb, otherGapProb,
+                   BEG(forwardScales));
+  Tantan<double> b(seqBeg, seqEnd, maxRepeatOffset,
+                   BEG(m.rows), repeatProb, repeatEndProb,
+                   repeatOffsetProbDecay, firstGapProb, otherGapProb,
+                   BEG(backwardScales));
+  LetterCodes<double> codes(seqBeg, seqEnd, BEG(m.rows));
+  f.setLetterCodes(codes);
+  b.setLetterCodes(codes);
+  const uchar *seqMid = seqBeg + (seqEnd - seqBeg) / 2;
+
+  f.initializeForwardAlgorithm();
+  b.initializeBackwardAlgorithm();
+  b.seqPtr = seqEnd;
+
+  std::thread t([&]() { b.calcBackwardProbsByItself(seqMid, probabilities); });
+  f.calcForwardProbs(seqMid, probabilities);
+  t.join();
+
+  std::vector<double> fState(f.numOfStates());
+  std::vector<double> bState(b.numOfStates());
+  f.getState(BEG(fState));
+  b.getState(BEG(bState));
+  double z = dotProduct(fState, bState);
+
+  double bz;
+  t = std::thread([&]() {
+      bz = b.calcBackwardRepeatProbs(seqBeg, probabilities, z,
+                                     BEG(forwardScales));
+    });
+  double fz = f.calcForwardRepeatProbs(seqEnd, probabilities, z,
+                                       BEG(backwardScales));
+  t.join();
+
+  checkForwardAndBackwardTotals(f.forwardTotal(), fz);
+  checkForwardAndBackwardTotals(bz, b.backwardTotal());
+}
+
+size_t defaultWindowOverlap(int maxRepeatOffset, double repeatEndProb) {
+  const double maxOverlap = 1 << 30;
+  double persistence = (repeatEndProb > 0) ?
+    std::log(1e-9) / std::log1p(-repeatEndProb) : maxOverlap;
+  double overlap = 4.0 * maxRepeatOffset + std::ceil(persistence);
+  return std::min(overlap, maxOverlap);
+}
+
+void getProbabilitiesOfSequences(const uchar *const *seqBegs,
+                                 const uchar *const *seqEnds,
+                                 size_t numOfSequences,
+                                 int maxRepeatOffset,
+                                 const const_double_ptr
+                                 *likelihoodRatioMatrix,
+                                 double repeatProb,
+                                 double repeatEndProb,
+                                 double repeatOffsetProbDecay,
+                                 double firstGapProb,
+                                 double otherGapProb,
+                                 float *const *probabilities) {
+  if (isSinglePrecision) {
+    CompactMatrix<float> m(likelihoodRatioMatrix, seqBegs, seqEnds,
+                           numOfSequences);
+    calcRepeatProbsOfSequences(seqBegs, seqEnds, numOfSequences,
+                               maxRepeatOffset, BEG(m.rows), repeatProb,
+                               repeatEndProb, repeatOffsetProbDecay,
+                               firstGapProb, otherGapProb, probabilities);
+  } else {
+    CompactMatrix<double> m(likelihoodRatioMatrix, seqBegs, seqEnds,
+                            numOfSequences);
+    calcRepeatProbsOfSequences(seqBegs, seqEnds, numOfSequences,
+                               maxRepeatOffset, BEG(m.rows), repeatProb,
+                               repeatEndProb, repeatOffsetProbDecay,
+                               firstGapProb, otherGapProb, probabilities);
+  }
+}
+
+// The smallest float t such that, for any float x, x >= minProb
+// exactly when x >= t: so we can compare floats with floats
+float floatThreshold(double minProb) {
+  float t = static_cast<float>(minProb);
+  if (t < minProb)
+    t = std::nextafter(t, std::numeric_limits<float>::infinity());
+  return t;
+}
+
+// The first x in [beg, end) such that (x >= t) == isProbable, or end
+template <bool isProbable>
+const float *findMaskEdge(const float *beg, const float *end, float t) {
+  typedef Simd<float> S;
+  S::V tV = S::fill(t);
+  for (; end - beg >= S::len; beg += S::len) {
+    int bits = simdGeMaskFlt(S::load(beg), tV);
+    if (!isProbable) bits ^= (1 << S::len) - 1;
+    if (bits) return beg + __builtin_ctz(bits);
+  }
+  while (beg < end && (*beg >= t) != isProbable) ++beg;
+  return beg;
+}
+
+const float *findProbable(const float *beg, const float *end,
+                          double minMaskProb) {
+  return findMaskEdge<true>(beg, end, floatThreshold(minMaskProb));
+}
+
+const float *findImprobable(const float *beg, const float *end,
+                            double minMaskProb) {
+  return findMaskEdge<false>(beg, end, floatThreshold(minMaskProb));
+}
+
+// Replaces bytes x with table[x].  If isStopping, it stops before
+// any x whose table[x] is 255, and returns a pointer to it.
+
+// With SSSE3, it does simdBytes bytes at once, if they are all < 128,
+// by looking up x - 16k in the k-th 16-byte part of the table, for
+// k = 0..7.  The lookup (simdChoose1) gives 0 if x - 16k < 0, and a
+// junk entry if x - 16k >= 16, so each part is stored XORed with the
+// previous one, and XORing the lookups cancels the junk.
+
+struct ByteTransformer {
+  const uchar *table;
+#if defined __SSE4_1__
+  SimdInt parts[8];
+#endif
+
+  explicit ByteTransformer(const uchar *table) : table(table) {
+#if defined __SSE4_1__
+    for (int k = 0; k < 8; ++k) {
+      uchar part[16];
+      for (int i = 0; i < 16; ++i)
+	part[i] = table[k * 16 + i] ^ (k ? table[k * 16 - 16 + i] : 0);
+      parts[k] = simdFill16x1(part);
+    }
+#endif
+  }
+
+  uchar *transformOneByOne(uchar *beg, uchar *end, bool isStopping) const {
+    for (; beg < end; ++beg) {
+      uchar y = table[*beg];
+      if (isStopping && y == 255) break;
+      *beg = y;
+    }
+    return beg;
+  }
+
+  uchar *transform(uchar *beg, uchar *end, bool isStopping) const {
+#if defined __SSE4_1__
+    SimdInt sixteen = simdFill1(16);
+    SimdInt stopValue = simdFill1(-1);
+    for (; end - beg >= simdBytes; beg += simdBytes) {
+      SimdInt x = simdLoad1(beg);
+      if (!simdHighBits1(x)) {
+	SimdInt y = simdChoose1(parts[0], x);
+	for (int k = 1; k < 8; ++k) {
+	  x = simdSub1(x, sixteen);
+	  y = simdXor1(y, simdChoose1(parts[k], x));
+	}
+	if (!isStopping || !simdHighBits1(simdGe1(y, stopValue))) {
+	  simdStore1(beg, y);
+	  continue;
+	}
+      }
+      uchar *e = transformOneByOne(beg, beg + simdBytes, isStopping);
+      if (e < beg + simdBytes) return e;
+    }
+#endif
+    return transformOneByOne(beg, end, isStopping);
+  }
+};
+
+uchar *transformLetters(uchar *beg, uchar *end, const uchar *table) {
+  ByteTransformer t(table);
+  return t.transform(beg, end, true);
 }
 
+// This finds the masked runs with SIMD compares, so it only touches
+// the letters in them
 void maskProbableLetters(uchar *seqBeg,
                          uchar *seqEnd,
                          const float *probabilities,
                          double minMaskProb,
                          const uchar *maskTable) {
-  while (seqBeg < seqEnd) {
-    if (*probabilities >= minMaskProb)
-      *seqBeg = maskTable[*seqBeg];
-    ++probabilities;
-    ++seqBeg;
+  ByteTransformer t(maskTable);
+  float minProb = floatThreshold(minMaskProb);
+  const float *probEnd = probabilities + (seqEnd - seqBeg);
+  const float *i = probabilities;
+  while ((i = findMaskEdge<true>(i, probEnd, minProb)) < probEnd) {
+    const float *j = findMaskEdge<false>(i, probEnd, minProb);
+    t.transform(seqBeg + (i - probabilities), seqBeg + (j - probabilities),
+		false);
+    i = j;
+  }
+}
+
+// The forward algorithm's state is stored only at the start of each
+// segment.  The backward algorithm does the segments in reverse
+// order, redoing each one's forward algorithm from its stored state.
+// Each segment is done with seqBeg moved to maxRepeatOffset letters
+// before it (which only changes where it rescales), so it needs
+// scale factors and probabilities for just that segment.  The
+// forward-backward total is the same for every segment, because
+// each segment's end state is the next one's stored state.
+
+template <typename T>
+void maskWithCheckpoints(uchar *seqBeg,
+                         uchar *seqEnd,
+                         int maxRepeatOffset,
+                         const T *const *likelihoodRatioMatrix,
+                         double repeatProb,
+                         double repeatEndProb,
+                         double repeatOffsetProbDecay,
+                         double firstGapProb,
+                         double otherGapProb,
+                         double minMaskProb,
+                         const uchar *maskTable) {
+  if (seqBeg == seqEnd) return;  // else there are no checkpoints
+  const size_t minSegmentLength = 1 << 16;
+  Tantan<T> model(seqBeg, seqEnd, maxRepeatOffset, likelihoodRatioMatrix,
+                  repeatProb, repeatEndProb, repeatOffsetProbDecay,
+                  firstGapProb, otherGapProb, 0);
+  size_t seqLen = seqEnd - seqBeg;
+  size_t numOfStates = model.numOfStates();
+  size_t segLen = std::max(minSegmentLength,
+                           size_t(std::sqrt(1.0 * seqLen * numOfStates)));
+  size_t numOfSegments = (seqLen + segLen - 1) / segLen;
+  size_t maxBefore = maxRepeatOffset;
+
+  std::vector<T> checkpoints(numOfSegments * numOfStates);
+  std::vector<T> scaleFactors((segLen + maxBefore) /
+                              Tantan<T>::scaleStepSize);
+  std::vector<float> probs(segLen + maxBefore);
+  std::vector<T> forwardEnd(numOfStates);
+  std::vector<T> backwardState(numOfStates);
+  model.scaleFactors = BEG(scaleFactors);
+
+  auto begOf = [&](size_t c) { return seqBeg + c * segLen; };
+  auto endOf = [&](size_t c) {
+    return seqBeg + std::min((c + 1) * segLen, seqLen);
+  };
+  auto contextBegOf = [&](size_t c) {
+    return begOf(c) - std::min(c * segLen, maxBefore);
+  };
+
+  // Does segment c's forward algorithm, and gets its end state:
+  auto doForward = [&](size_t c, Tantan<T> &t, T *endState) {
+    t.seqBeg = contextBegOf(c);
+    t.seqPtr = begOf(c);
+    t.setState(&checkpoints[c * numOfStates]);
+    t.calcForwardProbs(endOf(c), BEG(probs));
+    t.getState(endState);
+  };
+
+  model.initializeForwardAlgorithm();
+  model.getState(BEG(checkpoints));
+  for (size_t c = 0; c + 1 < numOfSegments; ++c) {
+    Tantan<T> t(model);
+    LetterCodes<T> codes(contextBegOf(c), endOf(c), likelihoodRatioMatrix);
+    t.setLetterCodes(codes);
+    doForward(c, t, &checkpoints[(c + 1) * numOfStates]);
+  }
+
+  model.initializeBackwardAlgorithm();
+  model.getState(BEG(backwardState));
+  for (size_t c = numOfSegments; c-- > 0; ) {
+    Tantan<T> t(model);
+    LetterCodes<T> codes(contextBegOf(c), endOf(c), likelihoodRatioMatrix);
+    t.setLetterCodes(codes);
+    doForward(c, t, BEG(forwardEnd));
+    T z = std::inner_product(forwardEnd.begin(), forwardEnd.end(),
+                             backwardState.begin(), T(0));
+    t.setState(BEG(backwardState));
+    t.calcBackwardProbs(begOf(c), BEG(probs), z);
+    t.getState(BEG(backwardState));
+    T z2 = std::inner_product(backwardState.begin(), backwardState.end(),
+                              &checkpoints[c * numOfStates], T(0));
+    checkForwardAndBackwardTotals(z, z2);
+    // Masking this segment doesn't change the letters that earlier
+    // segments use
+    maskProbableLetters(begOf(c), endOf(c),
+                        &probs[begOf(c) - contextBegOf(c)],
+                        minMaskProb, maskTable);
+  }
+}
+
+void maskSequencesWithCheckpoints(uchar *seqBeg,
+                                  uchar *seqEnd,
+                                  int maxRepeatOffset,
+                                  const const_double_ptr
+                                  *likelihoodRatioMatrix,
+                                  double repeatProb,
+                                  double repeatEndProb,
+                                  double repeatOffsetProbDecay,
+                                  double firstGapProb,
+                                  double otherGapProb,
+                                  double minMaskProb,
+                                  const uchar *maskTable) {
+  if (isSinglePrecision) {
+    CompactMatrix<float> m(likelihoodRatioMatrix, &seqBeg, &seqEnd, 1);
+    maskWithCheckpoints(seqBeg, seqEnd, maxRepeatOffset, BEG(m.rows),
+                        repeatProb, repeatEndProb, repeatOffsetProbDecay,
+                        firstGapProb, otherGapProb, minMaskProb, maskTable);
+  } else {
+    CompactMatrix<double> m(likelihoodRatioMatrix, &seqBeg, &seqEnd, 1);
+    maskWithCheckpoints(seqBeg, seqEnd, maxRepeatOffset, BEG(m.rows),
+                        repeatProb, repeatEndProb, repeatOffsetProbDecay,
+                        firstGapProb, otherGapProb, minMaskProb, maskTable);
+  }
+}
+
+// The forward algorithm is exact, from the stored state, but the
+// backward algorithm starts at seqEnd as if the sequence ended there.
+// seqBeg is moved to contextBeg, so the scale factors and
+// probabilities need only be as long as this piece of sequence.
+
+template <typename T>
+void calcProbsWithLookahead(const uchar *contextBeg,
+                            const uchar *seqBeg,
+                            const uchar *seqMid,
+                            const uchar *seqEnd,
+                            int maxRepeatOffset,
+                            const T *const *likelihoodRatioMatrix,
+                            double repeatProb,
+                            double repeatEndProb,
+                            double repeatOffsetProbDecay,
+                            double firstGapProb,
+                            double otherGapProb,
+                            double *forwardState,
+                            float *probabilities) {
+  std::vector<T> scaleFactors((seqEnd - contextBeg) /
+                              Tantan<T>::scaleStepSize);
+  Tantan<T> tantan(contextBeg, seqEnd, maxRepeatOffset,
+                   likelihoodRatioMatrix, repeatProb, repeatEndProb,
+                   repeatOffsetProbDecay, firstGapProb, otherGapProb,
+                   BEG(scaleFactors));
+  LetterCodes<T> codes(contextBeg, seqEnd, likelihoodRatioMatrix);
+  tantan.setLetterCodes(codes);
+  std::vector<float> probs(seqEnd - contextBeg);
+  std::vector<T> state(tantan.numOfStates());
+  std::vector<T> backwardState(tantan.numOfStates());
+
+  if (seqBeg == contextBeg) {
+    tantan.initializeForwardAlgorithm();
+  } else {
+    std::copy(forwardState, forwardState + state.size(), BEG(state));
+    tantan.setState(BEG(state));
+  }
+  tantan.seqPtr = seqBeg;
+  tantan.calcForwardProbs(seqMid, BEG(probs));
+  tantan.getState(BEG(state));
+  // Normalize it, because a short piece might not get rescaled
+  T total = std::accumulate(state.begin(), state.end(), T(0));
+  for (size_t i = 0; i < state.size(); ++i)
+    forwardState[i] = state[i] / total;
+  tantan.calcForwardProbs(seqEnd, BEG(probs));
+  tantan.getState(BEG(state));
+
+  tantan.initializeBackwardAlgorithm();
+  tantan.getState(BEG(backwardState));
+  T z = std::inner_product(state.begin(), state.end(),
+                           backwardState.begin(), T(0));
+  tantan.calcBackwardProbs(seqBeg, BEG(probs), z);
+  std::copy(&probs[seqBeg - contextBeg], &probs[seqMid - contextBeg],
+            probabilities);
+}
+
+void getProbabilitiesWithLookahead(const uchar *contextBeg,
+                                   const uchar *seqBeg,
+                                   const uchar *seqMid,
+                                   const uchar *seqEnd,
+                                   int maxRepeatOffset,
+                                   const const_double_ptr
+                                   *likelihoodRatioMatrix,
+                                   double repeatProb,
+                                   double repeatEndProb,
+                                   double repeatOffsetProbDecay,
+                                   double firstGapProb,
+                                   double otherGapProb,
+                                   double *forwardState,
+                                   float *probabilities) {
+  if (isSinglePrecision) {
+    CompactMatrix<float> m(likelihoodRatioMatrix, &contextBeg, &seqEnd, 1);
+    calcProbsWithLookahead(contextBeg, seqBeg, seqMid, seqEnd,
+                           maxRepeatOffset, BEG(m.rows), repeatProb,
+                           repeatEndProb, repeatOffsetProbDecay,
+                           firstGapProb, otherGapProb, forwardState,
+                           probabilities);
+  } else {
+    CompactMatrix<double> m(likelihoodRatioMatrix, &contextBeg, &seqEnd, 1);
+    calcProbsWithLookahead(contextBeg, seqBeg, seqMid, seqEnd,
+                           maxRepeatOffset, BEG(m.rows), repeatProb,
+                           repeatEndProb, repeatOffsetProbDecay,
+                           firstGapProb, otherGapProb, forwardState,
+                           probabilities);
   }
 }
 
@@ -539,10 +2174,400 @@ void countTransitions(const uchar *seqBeg,
                       double firstGapProb,
                       double otherGapProb,
                       double *transitionCounts) {
-  Tantan tantan(seqBeg, seqEnd, maxRepeatOffset, likelihoodRatioMatrix,
-                repeatProb, repeatEndProb, repeatOffsetProbDecay,
-                firstGapProb, otherGapProb);
+  size_t numOfScaleFactors =
+    (seqEnd - seqBeg) / Tantan<double>::scaleStepSize;
+  std::vector<double> scaleFactors(numOfScaleFactors);
+  CompactMatrix<double> m(likelihoodRatioMatrix, &seqBeg, &seqEnd, 1);
+  Tantan<double> tantan(seqBeg, seqEnd, maxRepeatOffset,
+                        BEG(m.rows), repeatProb, repeatEndProb,
+                        repeatOffsetProbDecay, firstGapProb, otherGapProb,
+                        BEG(scaleFactors));
+  LetterCodes<double> codes(seqBeg, seqEnd, BEG(m.rows));
+  tantan.setLetterCodes(codes);
   tantan.countTransitions(transitionCounts);
 }
 
+// The Viterbi algorithm's running maxima, like t = max(t + g, x[i]),
+// are chains of dependent operations.  To use SIMD, yet get exactly
+// the same scores as a scalar loop (so the traceback is unchanged), we
+// use the fact that rounded addition is monotonic: max(x, y) + g ==
+// max(x + g, y + g) exactly.  So each lane can keep its own maximum,
+// for offsets S::len apart, adding g S::len times per vector.
+
+struct RepeatFinderScorer {
+  typedef Simd<double> S;
+  typedef S::V V;
+
+  const RepeatFinderModel &m;
+  const uchar *seqPtr;
+  const double *lrRow;
+  int maxOffset;
+
+  RepeatFinderScorer(const RepeatFinderModel &model,
+		     const uchar *seqBeg, const uchar *seqPtr)
+    : m(model), seqPtr(seqPtr), lrRow(model.substitutionMatrix[*seqPtr]),
+      maxOffset(std::min(seqPtr - seqBeg, ptrdiff_t(model.maxRepeatOffset))) {}
+
+  static V addRepeatedly(V x, V g, int n) {
+    for (int i = 0; i < n; ++i) x = S::add(x, g);
+    return x;
+  }
+
+  // Continues t = max(t + g, x[i]) over the lanes of x
+  static double maxPlusLanes(double t, V x, double g) {
+    double a[S::len];
+    S::store(a, x);
+    for (int i = 0; i < S::len; ++i) t = std::max(t + g, a[i]);
+    return t;
+  }
+
+  // The emission scores for offsets i, i+1, etc.
+  V emissions(int i) const { return S::gatherBack(lrRow, seqPtr - i + 1); }
+
+  void calcScores(const double *oldScores, double *scores) const {
+    int w = m.maxRepeatOffset;
+    double toBackground = m.f2b + oldScores[0];
+    double g = m.b2fGrowth;
+    V bV = S::fill(toBackground);
+    V tV = S::fill(m.f2f0);
+    V gV = S::fill(g);
+    V toForegroundV = S::fill(-HUGE_VAL);
+
+    int i = 1;
+    for (; i <= maxOffset - S::len + 1; i += S::len) {
+      V fV = S::add(S::load(oldScores + i), emissions(i));
+      S::store(scores + i, S::max(bV, S::add(tV, fV)));
+      toForegroundV = S::max(addRepeatedly(toForegroundV, gV, S::len), fV);
+    }
+
+    double toForeground = maxPlusLanes(-HUGE_VAL, toForegroundV, g);
+
+    for (; i <= maxOffset; ++i) {
+      double f = oldScores[i] + lrRow[seqPtr[-i]];
+      toForeground = std::max(toForeground + g, f);
+      scores[i] = std::max(toBackground, m.f2f0 + f);
+    }
+
+    for (; i <= w; ++i) {
+      toForeground += g;
+      scores[i] = toBackground;
+    }
+
+    scores[0] = std::max(m.b2b + oldScores[0], m.b2fLast + toForeground);
+  }
+
+  void calcEmissionScores(const double *oldScores, double *scores) const {
+    int w = m.maxRepeatOffset;
+    scores[0] = oldScores[0];
+    int i = 1;
+    for (; i <= maxOffset - S::len + 1; i += S::len)
+      S::store(scores + i, S::add(S::load(oldScores + i), emissions(i)));
+    for (; i <= maxOffset; ++i)
+      scores[i] = oldScores[i] + lrRow[seqPtr[-i]];
+    for (; i <= w; ++i)
+      scores[i] = -HUGE_VAL;
+    std::copy(oldScores + i, oldScores + w * 2, scores + i);
+  }
+
+  // The deletion scores obey d[k] = max(oneGapScore + f[k], g2g +
+  // d[k-1]).  Each vector gets the maxima over its own lanes with
+  // S::len - 1 shifts, which don't depend on the previous vector, then
+  // only needs d from the previous vector plus g2g 1, 2, ... times.
+
+  void calcBackwardTransitionScoresWithGaps(double *scores) const {
+    int w = m.maxRepeatOffset;
+    double toBackground = m.f2b + scores[0];
+    double *fp = scores + 1;
+    double *ip = scores + 1 + w;
+    double g = m.b2fGrowth;
+    double e = m.g2g;
+
+    double f = fp[0];
+    fp[0] = std::max(std::max(toBackground, m.f2f1 + f), ip[0]);
+    double d = m.endGapScore + f;
+
+    double a[S::len];
+    std::fill_n(a, S::len, -HUGE_VAL);
+    a[S::len - 1] = f;  // as if offset 0 were the last lane of a vector
+    V toForegroundV = S::load(a);
+
+    V bV = S::fill(toBackground);
+    V t2V = S::fill(m.f2f2);
+    V oV = S::fill(m.oneGapScore);
+    V eV = S::fill(e);
+    V gV = S::fill(g);
+
+    int k = 1;
+    for (; k <= w - 1 - S::len; k += S::len) {
+      V fV = S::load(fp + k);
+      V iV = S::load(ip + k);
+      V oneGapV = S::add(oV, fV);
+      V dV = oneGapV;
+      for (int s = 1; s < S::len; ++s)
+	dV = S::max(dV, S::add(eV, S::shiftIn(dV, -HUGE_VAL)));
+      double c[S::len + 1];
+      c[0] = d;
+      for (int j = 1; j <= S::len; ++j) c[j] = c[j - 1] + e;
+      S::store(a, dV);
+      d = std::max(a[S::len - 1], c[S::len]);
+      dV = S::max(S::shiftIn(dV, -HUGE_VAL), S::load(c));
+      V xV = S::max(bV, S::add(t2V, fV));
+      S::store(fp + k, S::max(xV, S::max(iV, dV)));
+      S::store(ip + k - 1, S::max(oneGapV, S::add(eV, iV)));
+      toForegroundV = S::max(addRepeatedly(toForegroundV, gV, S::len), fV);
+    }
+
+    double toForeground = maxPlusLanes(-HUGE_VAL, toForegroundV, g);
+
+    for (; k < w - 1; ++k) {
+      f = fp[k];
+      toForeground = std::max(toForeground + g, f);
+      double i = ip[k];
+      fp[k] = std::max(std::max(toBackground, m.f2f2 + f), std::max(i, d));
+      double oneGapScore_f = m.oneGapScore + f;
+      ip[k - 1] = std::max(oneGapScore_f, e + i);
+      d = std::max(oneGapScore_f, e + d);
+    }
+
+    f = fp[k];
+    toForeground = std::max(toForeground + g, f);
+    fp[k] = std::max(std::max(toBackground, m.f2f1 + f), d);
+    ip[k - 1] = m.endGapScore + f;
+
+    scores[0] = std::max(m.b2b + scores[0], m.b2fLast + toForeground);
+  }
+};
+
+void calcRepeatFinderScores(const RepeatFinderModel &model,
+			    const uchar *seqBeg, const uchar *seqPtr,
+			    const double *oldScores, double *scores) {
+  RepeatFinderScorer s(model, seqBeg, seqPtr);
+  if (model.endGapScore > -HUGE_VAL) {
+    s.calcEmissionScores(oldScores, scores);
+    s.calcBackwardTransitionScoresWithGaps(scores);
+  } else {
+    s.calcScores(oldScores, scores);
+  }
+}
+
+// The 16-bit integer version.  The additions saturate, so -32768
+// acts like minus infinity.  Integer max is exact, so we can take
+// maxima in any order, and we get b2f scores from a table instead of
+// a chain of additions.
+
+static int addSaturated(int x, int y) {
+  int z = x + y;
+  return std::min(std::max(z, SHRT_MIN), SHRT_MAX);
+}
+
+struct RepeatFinderIntScorer {
+  typedef SimdInt2 V;
+  enum { len = simdLen2 };
+
+  const RepeatFinderModel &m;
+  const RepeatFinderScores<int> &s;
+  const short *b2f;
+  const uchar *seqPtr;
+  const short *row;
+  int maxOffset;
+#if defined __SSE4_1__
+  SimdInt lows;  // the low bytes of row[0], ..., row[15]
+  SimdInt highs;
+#endif
+
+  RepeatFinderIntScorer(const RepeatFinderModel &model,
+			const uchar *seqBeg, const uchar *seqPtr)
+    : m(model), s(model.intScores), b2f(BEG(model.b2fIntScores)),
+      seqPtr(seqPtr), row(model.intMatrixRows[*seqPtr]),
+      maxOffset(std::min(seqPtr - seqBeg, ptrdiff_t(model.maxRepeatOffset))) {
+#if defined __SSE4_1__
+    uchar l[16], h[16];
+    for (int i = 0; i < 16; ++i) {
+      l[i] = row[i];
+      h[i] = row[i] >> 8;
+    }
+    lows = simdFill16x1(l);
+    highs = simdFill16x1(h);
+#endif
+  }
+
+  static V fill(int x) { return simdFill2(x); }
+
+  // The emission scores for offsets i, i+1, etc.  Usually, for DNA, the
+  // letter codes are < 16, so we can get them with byte shuffles.
+  V emissions(int i) const {
+#if defined __SSE4_1__
+    V x;
+    if (simdChooseBack2(x, lows, highs, seqPtr - i)) return x;
+#endif
+    short e[len];
+    for (int j = 0; j < len; ++j) e[j] = row[seqPtr[-i - j]];
+    return simdLoad2(e);
+  }
+
+  int emission(int i) const { return row[seqPtr[-i]]; }
+
+  void calcScores(const short *oldScores, short *scores) const {
+    int w = m.maxRepeatOffset;
+    int toBackground = addSaturated(s.f2b, oldScores[0]);
+    V bV = fill(toBackground);
+    V tV = fill(s.f2f0);
+    V toForegroundV = fill(SHRT_MIN);
+
+    int i = 1;
+    for (; i <= maxOffset - len + 1; i += len) {
+      V fV = simdAdds2(simdLoad2(oldScores + i), emissions(i));
+      simdStore2(scores + i, simdMax2(bV, simdAdds2(tV, fV)));
+      V xV = simdAdds2(fV, simdLoad2(b2f + i));
+      toForegroundV = simdMax2(toForegroundV, xV);
+    }
+
+    int toForeground = simdHorizontalMax2(toForegroundV);
+
+    for (; i <= maxOffset; ++i) {
+      int f = addSaturated(oldScores[i], emission(i));
+      toForeground = std::max(toForeground, addSaturated(f, b2f[i]));
+      scores[i] = std::max(toBackground, addSaturated(s.f2f0, f));
+    }
+
+    for (; i <= w; ++i) scores[i] = toBackground;
+
+    scores[0] = std::max(addSaturated(s.b2b, oldScores[0]), toForeground);
+  }
+
+  void calcEmissionScores(const short *oldScores, short *scores) const {
+    int w = m.maxRepeatOffset;
+    scores[0] = oldScores[0];
+    int i = 1;
+    for (; i <= maxOffset - len + 1; i += len) {
+      V fV = simdAdds2(simdLoad2(oldScores + i), emissions(i));
+      simdStore2(scores + i, fV);
+    }
+    for (; i <= maxOffset; ++i)
+      scores[i] = addSaturated(oldScores[i], emission(i));
+    for (; i <= w; ++i)
+      scores[i] = SHRT_MIN;
+    std::copy(oldScores + i, oldScores + w * 2, scores + i);
+  }
+
+  // The deletion scores d[k] = max(oneGapScore + f[k], g2g + d[k-1])
+  // are a running maximum within each vector, done in log2(len)
+  // steps, then the previous vector's last d plus g2g 1, 2, ... times.
+  // Only the last d of each vector is a chain of dependent operations.
+
+  void calcBackwardTransitionScoresWithGaps(short *scores) const {
+    int w = m.maxRepeatOffset;
+    int toBackground = addSaturated(s.f2b, scores[0]);
+    short *fp = scores + 1;
+    short *ip = scores + 1 + w;
+    int e = s.g2g;
+
+    int f = fp[0];
+    int i0 = ip[0];
+    fp[0] = std::max(std::max(toBackground, addSaturated(s.f2f1, f)), i0);
+    int d = addSaturated(s.endGapScore, f);
+    int toForeground = addSaturated(f, b2f[1]);
+
+    short c[len];
+    for (int j = 0; j < len; ++j) c[j] = addSaturated(0, (j + 1) * e);
+    V cV = simdLoad2(c);
+    V minV = fill(SHRT_MIN);
+    V bV = fill(toBackground);
+    V t2V = fill(s.f2f2);
+    V oV = fill(s.oneGapScore);
+    V eV = fill(e);
+    V toForegroundV = minV;
+
+    int k = 1;
+    for (; k <= w - 1 - len; k += len) {
+      V fV = simdLoad2(fp + k);
+      V iV = simdLoad2(ip + k);
+      V oneGapV = simdAdds2(oV, fV);
+      V dV = oneGapV;
+      for (int n = 1; n < len; n *= 2) {
+	V gV = fill(addSaturated(0, n * e));
+	dV = simdMax2(dV, simdAdds2(simdShiftIn2(dV, minV, n), gV));
+      }
+      V oldV = fill(d);
+      d = std::max(simdLast2(dV), addSaturated(d, c[len - 1]));
+      dV = simdShiftIn2(simdMax2(dV, simdAdds2(oldV, cV)), oldV, 1);
+      V xV = simdMax2(bV, simdAdds2(t2V, fV));
+      simdStore2(fp + k, simdMax2(xV, simdMax2(iV, dV)));
+      simdStore2(ip + k - 1, simdMax2(oneGapV, simdAdds2(eV, iV)));
+      V yV = simdAdds2(fV, simdLoad2(b2f + 1 + k));
+      toForegroundV = simdMax2(toForegroundV, yV);
+    }
+
+    toForeground = std::max(toForeground, simdHorizontalMax2(toForegroundV));
+
+    for (; k < w - 1; ++k) {
+      f = fp[k];
+      toForeground = std::max(toForeground, addSaturated(f, b2f[k + 1]));
+      int i = ip[k];
+      int x = std::max(toBackground, addSaturated(s.f2f2, f));
+      fp[k] = std::max(x, std::max(i, d));
+      int oneGapScore_f = addSaturated(s.oneGapScore, f);
+      ip[k - 1] = std::max(oneGapScore_f, addSaturated(e, i));
+      d = std::max(oneGapScore_f, addSaturated(e, d));
+    }
+
+    f = fp[k];
+    toForeground = std::max(toForeground, addSaturated(f, b2f[k + 1]));
+    fp[k] = std::max(std::max(toBackground, addSaturated(s.f2f1, f)), d);
+    ip[k - 1] = addSaturated(s.endGapScore, f);
+
+    scores[0] = std::max(addSaturated(s.b2b, scores[0]), toForeground);
+  }
+
+  // Shifts the scores so the background score is 0
+  void renormalize(short *scores) const {
+    int n = m.dpScoresPerLetter;
+    int shift = scores[0];
+    if (shift) {
+      V sV = fill(shift);
+      int i = 0;
+      for (; i <= n - len; i += len)
+	simdStore2(scores + i, simdSubs2(simdLoad2(scores + i), sV));
+      for (; i < n; ++i)
+	scores[i] = addSaturated(scores[i], -shift);
+    }
+    scores[n] = shift;
+  }
+};
+
+void calcRepeatFinderIntScores(const RepeatFinderModel &model,
+			       const uchar *seqBeg, const uchar *seqPtr,
+			       const short *oldScores, short *scores) {
+  RepeatFinderIntScorer s(model, seqBeg, seqPtr);
+  if (model.endGapScore > -HUGE_VAL) {
+    s.calcEmissionScores(oldScores, scores);
+    s.calcBackwardTransitionScoresWithGaps(scores);
+  } else {
+    s.calcScores(oldScores, scores);
+  }
+  s.renormalize(scores);
+}
+
+const SimdBackend backend = {
+  TANTAN_NAME(TANTAN_SIMD),
+  maskSequences,
+  maskSequencesWithCheckpoints,
+  getProbabilities,
+  getProbabilitiesOfSequences,
+  getProbabilitiesBidirectionally,
+  getProbabilitiesInWindows,
+  getProbabilitiesInChunks,
+  getProbabilitiesWithLookahead,
+  defaultWindowOverlap,
+  maskProbableLetters,
+  findProbable,
+  findImprobable,
+  transformLetters,
+  countTransitions,
+  calcRepeatFinderScores,
+  calcRepeatFinderIntScores,
+  setSinglePrecision
+};
+
+}
 }
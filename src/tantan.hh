@@ -51,6 +51,8 @@
 #ifndef TANTAN_HH
 #define TANTAN_HH
 
+#include <stddef.h>  // size_t
+
 namespace tantan {
 
 typedef unsigned char uchar;
@@ -68,6 +70,26 @@ void maskSequences(uchar *seqBeg,
                    double minMaskProb,
                    const uchar *maskTable);
 
+// The following routine masks the same letters as maskSequences (up
+// to rounding), but its memory use grows only as the square root of
+// the sequence length, so it suits huge sequences, e.g. chromosomes.
+// It stores the forward algorithm's state at checkpoints, and redoes
+// the forward algorithm between checkpoints during the backward
+// algorithm, so it needs about 1.5 times as much calculation.
+
+void maskSequencesWithCheckpoints(uchar *seqBeg,
+                                  uchar *seqEnd,
+                                  int maxRepeatOffset,
+                                  const const_double_ptr
+                                  *likelihoodRatioMatrix,
+                                  double repeatProb,
+                                  double repeatEndProb,
+                                  double repeatOffsetProbDecay,
+                                  double firstGapProb,
+                                  double otherGapProb,
+                                  double minMaskProb,
+                                  const uchar *maskTable);
+
 // The following routine gets the posterior probability that each
 // letter is repetitive.  It stores the results in "probabilities",
 // which must point to enough pre-allocated space to fit the results.
@@ -83,6 +105,130 @@ void getProbabilities(const uchar *seqBeg,
                       double otherGapProb,
                       float *probabilities);
 
+// The following routine does getProbabilities for many sequences
+// (each i from 0 to numOfSequences-1 has seqBegs[i], seqEnds[i],
+// probabilities[i]).  If there are no gaps, it does several
+// sequences at once, one per SIMD lane, which is faster for short
+// sequences (e.g. DNA reads).
+
+void getProbabilitiesOfSequences(const uchar *const *seqBegs,
+                                 const uchar *const *seqEnds,
+                                 size_t numOfSequences,
+                                 int maxRepeatOffset,
+                                 const const_double_ptr
+                                 *likelihoodRatioMatrix,
+                                 double repeatProb,
+                                 double repeatEndProb,
+                                 double repeatOffsetProbDecay,
+                                 double firstGapProb,
+                                 double otherGapProb,
+                                 float *const *probabilities);
+
+// The following routine gets the same probabilities as
+// getProbabilities (up to rounding), using 2 threads.  One thread does
+// the forward algorithm from the start of the sequence, and the other
+// does the backward algorithm from the end.  When they meet in the
+// middle, they each carry on to the other end, calculating the
+// probabilities on the way.
+
+void getProbabilitiesBidirectionally(const uchar *seqBeg,
+                                     const uchar *seqEnd,
+                                     int maxRepeatOffset,
+                                     const const_double_ptr
+                                     *likelihoodRatioMatrix,
+                                     double repeatProb,
+                                     double repeatEndProb,
+                                     double repeatOffsetProbDecay,
+                                     double firstGapProb,
+                                     double otherGapProb,
+                                     float *probabilities);
+
+// The following routine gets the same probabilities approximately,
+// using several threads.  It splits the sequence into windows of
+// windowLength letters, extends each window by windowOverlap letters
+// on both sides, and calculates each extended window independently.
+// Only the probabilities in the window interiors are kept.  If
+// windowOverlap is large enough, the result matches getProbabilities
+// to float precision.
+
+void getProbabilitiesInWindows(const uchar *seqBeg,
+                               const uchar *seqEnd,
+                               int maxRepeatOffset,
+                               const const_double_ptr *likelihoodRatioMatrix,
+                               double repeatProb,
+                               double repeatEndProb,
+                               double repeatOffsetProbDecay,
+                               double firstGapProb,
+                               double otherGapProb,
+                               float *probabilities,
+                               size_t windowLength,
+                               size_t windowOverlap,
+                               int numOfThreads);
+
+// The following routine gets the same probabilities as
+// getProbabilities (up to rounding), using several threads.  It
+// splits the sequence into chunks of chunkLength letters.  Since the
+// forward (and backward) algorithm is linear, each chunk maps its
+// start state to its end state by a matrix: the threads calculate
+// these matrices at the same time.  Then the exact state at each chunk
+// boundary is obtained by matrix-vector multiplication, and the
+// threads do the normal algorithm on each chunk.
+
+// This needs about twice as much calculation as getProbabilities, plus
+// (for each chunk) following every state through the first few
+// hundred letters of the chunk, so it is worthwhile for long sequences
+// and several threads.
+
+void getProbabilitiesInChunks(const uchar *seqBeg,
+                              const uchar *seqEnd,
+                              int maxRepeatOffset,
+                              const const_double_ptr *likelihoodRatioMatrix,
+                              double repeatProb,
+                              double repeatEndProb,
+                              double repeatOffsetProbDecay,
+                              double firstGapProb,
+                              double otherGapProb,
+                              float *probabilities,
+                              size_t chunkLength,
+                              int numOfThreads);
+
+// The following routine is for masking a sequence while it is still
+// being read (e.g. from a sequencer), with bounded memory and delay.
+// It gets the probabilities of the letters from seqBeg to seqMid,
+// using the letters from seqMid to seqEnd as look-ahead: the backward
+// algorithm starts at seqEnd as if the sequence ended there.  So the
+// result is approximate, unless seqEnd is the sequence end, but it is
+// accurate if the look-ahead is long enough (like windowOverlap).
+// The letters from contextBeg to seqBeg are the ones before seqBeg in
+// the sequence: there should be min(maxRepeatOffset, all) of them.
+
+// forwardState is the forward algorithm's state at seqBeg, which this
+// routine updates to the state at seqMid.  So the next call can start
+// at seqMid.  If contextBeg == seqBeg (the sequence start), its input
+// value is ignored.  It needs space for 2 * maxRepeatOffset numbers.
+
+void getProbabilitiesWithLookahead(const uchar *contextBeg,
+                                   const uchar *seqBeg,
+                                   const uchar *seqMid,
+                                   const uchar *seqEnd,
+                                   int maxRepeatOffset,
+                                   const const_double_ptr
+                                   *likelihoodRatioMatrix,
+                                   double repeatProb,
+                                   double repeatEndProb,
+                                   double repeatOffsetProbDecay,
+                                   double firstGapProb,
+                                   double otherGapProb,
+                                   double *forwardState,
+                                   float *probabilities);
+
+// The following routine suggests a windowOverlap: several times
+// maxRepeatOffset, plus the length over which a repeat persists with
+// probability > 1e-9 (because it ends with probability repeatEndProb
+// per position).
+
+size_t defaultWindowOverlap(int maxRepeatOffset, double repeatEndProb);
+
 // The following routine masks each letter whose corresponding entry
 // in "probabilities" is >= minMaskProb.
 
@@ -92,6 +238,25 @@ void maskProbableLetters(uchar *seqBeg,
                          double minMaskProb,
                          const uchar *maskTable);
 
+// The following routines find runs of letters to mask.  findProbable
+// returns a pointer to the first entry in [beg, end) that is >=
+// minMaskProb, and findImprobable to the first that is <
+// minMaskProb, or end if there is none.
+
+const float *findProbable(const float *beg, const float *end,
+                          double minMaskProb);
+
+const float *findImprobable(const float *beg, const float *end,
+                            double minMaskProb);
+
+// The following routine replaces each letter x in [beg, end) with
+// table[x], e.g. to encode or decode a sequence.  It stops at the
+// first letter whose table entry is 255 (an unknown letter, for
+// mcf::Alphabet::lettersToNumbers), and returns a pointer to it, or
+// to end if there is none.
+
+uchar *transformLetters(uchar *beg, uchar *end, const uchar *table);
+
 // The following routine counts the expected number of transitions
 // from the background (non-repeat) state to other states.  It adds
 // the results to "transitionCounts", which must point to
@@ -115,6 +280,27 @@ void countTransitions(const uchar *seqBeg,
                       double otherGapProb,
                       double *transitionCounts);
 
+// By default, the above routines calculate in double precision.
+// setSinglePrecision(true) makes getProbabilities,
+// getProbabilitiesOfSequences, getProbabilitiesInWindows,
+// getProbabilitiesWithLookahead, maskSequences, and
+// maskSequencesWithCheckpoints calculate in single precision instead,
+// which is faster (twice as many numbers per SIMD vector), but less
+// accurate: the probabilities change by up to about 5e-5.  It does
+// not affect the other routines.
+
+void setSinglePrecision(bool isSingle);
+
+// The above routines are compiled for several SIMD instruction sets,
+// and by default use the best one that this CPU supports.  simdName
+// returns the name of the one in use (e.g. "avx2").  setSimd selects
+// one by name ("auto" means the default), and returns false if the
+// name is unknown or this CPU does not support it.
+
+const char *simdName();
+
+bool setSimd(const char *name);
+
 }
 
 #endif
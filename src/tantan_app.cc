@@ -5,6 +5,8 @@
 
 #include "mcf_alphabet.hh"
 #include "mcf_fasta_sequence.hh"
+#include "mcf_mapped_file.hh"
+#include "mcf_pipeline.hh"
 #include "mcf_score_matrix.hh"
 #include "mcf_tantan_options.hh"
 #include "mcf_util.hh"
@@ -15,12 +17,16 @@
 #include <algorithm>  // copy, fill_n
 #include <cassert>
 #include <cmath>
+#include <condition_variable>
 #include <cstdlib>  // EXIT_SUCCESS, EXIT_FAILURE
 #include <exception>  // exception
 #include <fstream>
 #include <iostream>
+#include <memory>  // unique_ptr
+#include <mutex>
 #include <new>  // bad_alloc
 #include <string.h>
+#include <thread>
 
 #define BEG(v) ((v).empty() ? 0 : &(v).front())
 #define END(v) ((v).empty() ? 0 : &(v).back() + 1)
@@ -43,10 +49,11 @@ bool isDubiousDna(const uchar *beg, const uchar *end) {
   return false;
 }
 
+// These are set up once, at the start, and are read-only after that,
+// so that they can be shared by several threads:
 namespace {
 TantanOptions options;
 Alphabet alphabet;
-tantan::RepeatFinder repeatFinder;
 
 enum { scoreMatrixSize = 64 };
 int fastMatrix[scoreMatrixSize][scoreMatrixSize];
@@ -57,13 +64,97 @@ double *probMatrixPointers[scoreMatrixSize];
 double firstGapProb;
 double otherGapProb;
 
+tantan::RepeatFinderModel repeatFinderModel;  // for -f4
+
 uchar hardMaskTable[Alphabet::capacity];
 const uchar *maskTable;
+uchar bedMarkTable[Alphabet::capacity];  // for -f3 --checkpoints
+}
+
+// A sum that keeps track of its rounding error (Neumaier's method).
+// So the result hardly depends on how the numbers are grouped, e.g.
+// into jobs for different threads.
+struct CompensatedSum {
+  double sum;
+  double error;
+
+  void clear() { sum = error = 0; }
+
+  void add(double x) {
+    double t = sum + x;
+    error += (std::fabs(sum) >= std::fabs(x)) ? (sum - t) + x : (x - t) + sum;
+    sum = t;
+  }
+
+  void add(const CompensatedSum &s) { add(s.sum); add(s.error); }
+
+  double value() const { return sum + error; }
+};
+
+// Things that are summed over all the sequences:
+struct Totals {
+  std::vector<CompensatedSum> transitionCounts;  // for -f2
+  CompensatedSum transitionTotal;
+  std::vector<double> sequenceCounts;  // one sequence's -f2 counts
+  double maxProbDifference;  // for --check
+  size_t maskDifferences;  // for --check
+
+  void clear() {
+    for (size_t i = 0; i < transitionCounts.size(); ++i)
+      transitionCounts[i].clear();
+    transitionTotal.clear();
+    maxProbDifference = 0;
+    maskDifferences = 0;
+  }
+
+  void add(const Totals &t) {
+    for (size_t i = 0; i < transitionCounts.size(); ++i)
+      transitionCounts[i].add(t.transitionCounts[i]);
+    transitionTotal.add(t.transitionTotal);
+    maxProbDifference = std::max(maxProbDifference, t.maxProbDifference);
+    maskDifferences += t.maskDifferences;
+  }
+};
+
+// This is modified while processing sequences:
+namespace {
+Totals totals;
+
+// The number of -t threads in use: each job being done uses one,
+// and a long sequence's windows can claim the ones that are idle.
+std::mutex threadMutex;
+std::condition_variable threadFreed;
+int numOfBusyThreads = 0;
+}
 
-std::vector<double> transitionCounts;
-double transitionTotal;
+// Waits until a thread is idle, and uses it for a job.  So a job
+// doesn't start while the windows of a long sequence have claimed
+// all the threads, and no more than -t threads are ever busy.
+void startJob() {
+  std::unique_lock<std::mutex> lock(threadMutex);
+  while (numOfBusyThreads >= options.numOfThreads) threadFreed.wait(lock);
+  ++numOfBusyThreads;
 }
 
+void releaseThreads(int n) {
+  std::lock_guard<std::mutex> lock(threadMutex);
+  numOfBusyThreads -= n;
+  threadFreed.notify_all();
+}
+
+// Claims the idle threads, plus the caller's own (busy) thread
+class ThreadClaim {
+public:
+  ThreadClaim() {
+    std::lock_guard<std::mutex> lock(threadMutex);
+    int idle = std::max(options.numOfThreads - numOfBusyThreads, 0);
+    numOfBusyThreads += idle;
+    count = idle + 1;
+  }
+  ~ThreadClaim() { releaseThreads(count - 1); }
+  int count;
+};
+
 void initAlphabet() {
   if (options.isProtein) alphabet.fromString(Alphabet::protein);
   else                   alphabet.fromString(Alphabet::dna);
@@ -118,9 +209,11 @@ void initScoresAndProbabilities() {
     // XXX check if firstGapProb is too high
   }
 
-  repeatFinder.init(options.maxCycleLength, probMatrixPointers,
-		    options.repeatProb, options.repeatEndProb,
-		    options.repeatOffsetProbDecay, firstGapProb, otherGapProb);
+  repeatFinderModel.init(options.maxCycleLength, probMatrixPointers,
+			 options.repeatProb, options.repeatEndProb,
+			 options.repeatOffsetProbDecay,
+			 firstGapProb, otherGapProb);
+  if (options.isIntegerViterbi) repeatFinderModel.initIntegers(scoreMatrixSize);
 
   //std::cerr << "lambda: " << matrixLambda << "\n";
   //std::cerr << "firstGapProb: " << firstGapProb << "\n";
@@ -134,6 +227,10 @@ void initMaskTable() {
 
   if (maskSymbol == 0) maskTable = alphabet.numbersToLowercase;
   else                 maskTable = hardMaskTable;
+
+  // The letter codes are < 128, so the top bit can mark masked letters
+  for (unsigned i = 0; i < Alphabet::capacity; ++i)
+    bedMarkTable[i] = i | 128;
 }
 
 std::string firstWord(const std::string &s) {
@@ -143,6 +240,11 @@ std::string firstWord(const std::string &s) {
   return word;  // might be empty
 }
 
+void encodeInPlace(uchar *beg, uchar *end) {
+  uchar *bad = tantan::transformLetters(beg, end, alphabet.lettersToNumbers);
+  if (bad < end) throw Error(std::string("bad symbol: ") + char(*bad));
+}
+
 void writeBedLine(const std::string &seqName, const float *origin,
                   const float *beg, const float *end, std::ostream &out) {
   out << seqName << '\t' << (beg - origin) << '\t' << (end - origin) << '\n';
@@ -151,16 +253,26 @@ void writeBedLine(const std::string &seqName, const float *origin,
 void writeBed(const float *probBeg, const float *probEnd,
               const std::string &seqName, std::ostream &output) {
   if (seqName.empty()) throw Error("missing sequence name");
-  const float *maskBeg = 0;  // pointer to start of masked tract
-  for (const float *i = probBeg; i < probEnd; ++i) {
-    if (*i >= options.minMaskProb) {  // this position is masked
-      if (maskBeg == 0) maskBeg = i;
-    } else {  // this position is not masked
-      if (maskBeg) writeBedLine(seqName, probBeg, maskBeg, i, output);
-      maskBeg = 0;
-    }
+  double minProb = options.minMaskProb;
+  const float *i = probBeg;
+  while ((i = tantan::findProbable(i, probEnd, minProb)) < probEnd) {
+    const float *j = tantan::findImprobable(i, probEnd, minProb);
+    writeBedLine(seqName, probBeg, i, j, output);
+    i = j;
+  }
+}
+
+bool isMarked(uchar x) { return x >= 128; }
+
+void writeMarkedBed(const uchar *beg, const uchar *end,
+		    const std::string &seqName, std::ostream &output) {
+  if (seqName.empty()) throw Error("missing sequence name");
+  const uchar *i = beg;
+  while ((i = std::find_if(i, end, isMarked)) < end) {
+    const uchar *j = std::find_if_not(i, end, isMarked);
+    output << seqName << '\t' << (i - beg) << '\t' << (j - beg) << '\n';
+    i = j;
   }
-  if (maskBeg) writeBedLine(seqName, probBeg, maskBeg, probEnd, output);
 }
 
 void storeSequence(const uchar *beg, const uchar *end, std::string &out) {
@@ -221,7 +333,7 @@ const uchar *mainBeg(const std::vector<RepeatUnit> &repUnits, int len) {
 void writeRepeat(const FastaSequence &f,
 		 const uchar *repBeg, const uchar *repEnd,
 		 const std::string &repText, std::vector<RepeatUnit> &repUnits,
-		 const uchar *commaPos, int finalOffset) {
+		 const uchar *commaPos, int finalOffset, std::ostream &output) {
   double repeatCount = count(repText.begin(), repText.end(), ',');
   double copyNumber = repeatCount + (repEnd - commaPos) * 1.0 / finalOffset;
   if (copyNumber < options.minCopyNumber) return;
@@ -231,22 +343,24 @@ void writeRepeat(const FastaSequence &f,
   const uchar *bestBeg = mainBeg(repUnits, bestLen);
 
   const uchar *beg = BEG(f.sequence);
-  std::cout << firstWord(f.title) << '\t'
-	    << (repBeg - beg) << '\t' << (repEnd - beg) << '\t'
-	    << bestLen << '\t' << copyNumber << '\t';
+  output << firstWord(f.title) << '\t'
+	 << (repBeg - beg) << '\t' << (repEnd - beg) << '\t'
+	 << bestLen << '\t' << copyNumber << '\t';
   for (int i = 0; i < bestLen; ++i) {
     char c = std::toupper(alphabet.numbersToLetters[bestBeg[i]]);
-    std::cout << c;
+    output << c;
   }
-  std::cout << '\t';
-  std::cout << repText << '\n';
+  output << '\t';
+  output << repText << '\n';
 }
 
-void findRepeatsInOneSequence(const FastaSequence &f) {
+void findRepeatsInOneSequence(const FastaSequence &f,
+			      tantan::RepeatFinder &repeatFinder,
+			      std::ostream &output) {
   const uchar *beg = BEG(f.sequence);
   const uchar *end = END(f.sequence);
 
-  repeatFinder.calcBestPathScore(beg, end);
+  repeatFinder.calcBestPathScore(repeatFinderModel, beg, end);
 
   std::vector<RepeatUnit> repUnits;
   std::string repText;
@@ -259,7 +373,8 @@ void findRepeatsInOneSequence(const FastaSequence &f) {
 
     if (newState == 0) {
       if (state > 0) {
-	writeRepeat(f, repBeg, seqPtr, repText, repUnits, commaPos, state);
+	writeRepeat(f, repBeg, seqPtr, repText, repUnits, commaPos, state,
+		    output);
       }
     } else if (newState <= options.maxCycleLength) {
       if (state == 0) {
@@ -291,46 +406,176 @@ void findRepeatsInOneSequence(const FastaSequence &f) {
   }
 
   if (state > 0) {
-    writeRepeat(f, repBeg, end, repText, repUnits, commaPos, state);
+    writeRepeat(f, repBeg, end, repText, repUnits, commaPos, state, output);
   }
 }
 
-void processOneSequence(FastaSequence &f, std::ostream &output) {
+void getProbabilities(const uchar *beg, const uchar *end, float *probBeg) {
+  if (options.windowLength > 0 && size_t(end - beg) > options.windowLength &&
+      options.isExactWindows) {
+    ThreadClaim threads;
+    tantan::getProbabilitiesInChunks(beg, end, options.maxCycleLength,
+				     probMatrixPointers,
+				     options.repeatProb,
+				     options.repeatEndProb,
+				     options.repeatOffsetProbDecay,
+				     firstGapProb, otherGapProb, probBeg,
+				     options.windowLength, threads.count);
+  } else if (options.windowLength > 0 &&
+	     size_t(end - beg) > options.windowLength) {
+    ThreadClaim threads;
+    size_t overlap = (options.windowOverlap >= 0) ? options.windowOverlap :
+      tantan::defaultWindowOverlap(options.maxCycleLength,
+				   options.repeatEndProb);
+    tantan::getProbabilitiesInWindows(beg, end, options.maxCycleLength,
+				      probMatrixPointers,
+				      options.repeatProb,
+				      options.repeatEndProb,
+				      options.repeatOffsetProbDecay,
+				      firstGapProb, otherGapProb, probBeg,
+				      options.windowLength, overlap,
+				      threads.count);
+  } else if (options.isBidirectional) {
+    tantan::getProbabilitiesBidirectionally(beg, end, options.maxCycleLength,
+					    probMatrixPointers,
+					    options.repeatProb,
+					    options.repeatEndProb,
+					    options.repeatOffsetProbDecay,
+					    firstGapProb, otherGapProb,
+					    probBeg);
+  } else {
+    tantan::getProbabilities(beg, end, options.maxCycleLength,
+			     probMatrixPointers,
+			     options.repeatProb, options.repeatEndProb,
+			     options.repeatOffsetProbDecay,
+			     firstGapProb, otherGapProb, probBeg);
+  }
+}
+
+void maskWithCheckpoints(uchar *beg, uchar *end, const uchar *table) {
+  tantan::maskSequencesWithCheckpoints(beg, end, options.maxCycleLength,
+				       probMatrixPointers,
+				       options.repeatProb,
+				       options.repeatEndProb,
+				       options.repeatOffsetProbDecay,
+				       firstGapProb, otherGapProb,
+				       options.minMaskProb, table);
+}
+
+// Compare the probabilities with the basic calculation's:
+void checkProbabilities(const uchar *beg, const uchar *end,
+			const float *probBeg, Totals &sums) {
+  std::vector<float> basicProbs(end - beg);
+  tantan::getProbabilities(beg, end, options.maxCycleLength,
+			   probMatrixPointers,
+			   options.repeatProb, options.repeatEndProb,
+			   options.repeatOffsetProbDecay,
+			   firstGapProb, otherGapProb, BEG(basicProbs));
+  for (size_t i = 0; i < basicProbs.size(); ++i) {
+    double x = basicProbs[i];
+    double y = probBeg[i];
+    sums.maxProbDifference = std::max(sums.maxProbDifference,
+				      std::fabs(x - y));
+    sums.maskDifferences += (x >= options.minMaskProb) !=
+      (y >= options.minMaskProb);
+  }
+}
+
+// Sequences up to this length get their probabilities calculated
+// several at once, by getProbabilitiesOfSequences:
+const size_t maxBatchedLength = 10000;
+
+bool isBatchable(const FastaSequence &f) {
+  size_t length = f.sequence.size();
+  return (options.outputType == options.maskOut ||
+	  options.outputType == options.probOut ||
+	  options.outputType == options.bedOut) &&
+    length <= maxBatchedLength && !options.isBidirectional &&
+    (options.windowLength == 0 || length <= options.windowLength);
+}
+
+bool isSpace(char c) { return uchar(c) <= ' '; }
+
+// Puts the letters into a sequence record of the mapped input (which
+// may start with spaces), after its title line, skipping spaces.  It
+// changes only the bytes that differ, so unchanged pages don't get
+// copied.
+void putLettersInPlace(char *record, const std::vector<uchar> &letters) {
+  const char *i = reinterpret_cast<const char *>(BEG(letters));
+  const char *e = i + letters.size();
+  if (i == e) return;
+  while (isSpace(*record)) ++record;
+  while (*record != '\n') ++record;
+  char *p = record + 1;
+  while (i < e) {
+    char *n = static_cast<char *>(memchr(p, '\n', e - i));
+    char *stop = n ? n : p + (e - i);
+    char *lineEnd = stop;
+    while (lineEnd > p && uchar(lineEnd[-1]) <= ' ') --lineEnd;
+    if (std::find_if(p, lineEnd, isSpace) == lineEnd) {
+      size_t len = lineEnd - p;
+      if (memcmp(p, i, len)) memcpy(p, i, len);
+      i += len;
+    } else {
+      for (char *j = p; j < lineEnd; ++j) {
+	if (uchar(*j) <= ' ') continue;
+	if (*j != *i) *j = *i;
+	++i;
+      }
+    }
+    p = n ? n + 1 : stop;
+  }
+}
+
+// If probBeg is null, this calculates the probabilities itself.  If
+// record isn't null, the masked sequence goes there (for --mmap)
+// instead of to output.
+void processOneSequence(FastaSequence &f, float *probBeg, char *record,
+			tantan::RepeatFinder &repeatFinder,
+			std::ostream &output, Totals &sums) {
   uchar *beg = BEG(f.sequence);
   uchar *end = END(f.sequence);
 
-  alphabet.encodeInPlace(beg, end);
-
-  if (options.outputType == options.maskOut) {
-    tantan::maskSequences(beg, end, options.maxCycleLength,
-                          probMatrixPointers,
-                          options.repeatProb, options.repeatEndProb,
-                          options.repeatOffsetProbDecay,
-                          firstGapProb, otherGapProb,
-                          options.minMaskProb, maskTable);
-    alphabet.decodeInPlace(beg, end);
-    output << f;
-  } else if (options.outputType == options.countOut) {
+  if (options.outputType == options.countOut) {
+    std::vector<double> &counts = sums.sequenceCounts;
+    counts.assign(sums.transitionCounts.size(), 0.0);
     tantan::countTransitions(beg, end, options.maxCycleLength,
                              probMatrixPointers,
                              options.repeatProb, options.repeatEndProb,
                              options.repeatOffsetProbDecay,
-                             firstGapProb, otherGapProb,
-                             BEG(transitionCounts));
+                             firstGapProb, otherGapProb, BEG(counts));
+    for (size_t i = 0; i < counts.size(); ++i)
+      sums.transitionCounts[i].add(counts[i]);
     double sequenceLength = static_cast<double>(f.sequence.size());
-    transitionTotal += sequenceLength + 1;
+    sums.transitionTotal.add(sequenceLength + 1);
   } else if (options.outputType == options.repOut) {
-    findRepeatsInOneSequence(f);
+    findRepeatsInOneSequence(f, repeatFinder, output);
+  } else if (options.isCheckpointed && !probBeg &&
+	     options.outputType == options.maskOut) {
+    maskWithCheckpoints(beg, end, maskTable);
+    tantan::transformLetters(beg, end, alphabet.numbersToLetters);
+    if (record) putLettersInPlace(record, f.sequence);
+    else output << f;
+  } else if (options.isCheckpointed && !probBeg &&
+	     options.outputType == options.bedOut) {
+    maskWithCheckpoints(beg, end, bedMarkTable);
+    writeMarkedBed(beg, end, firstWord(f.title), output);
   } else {
-    std::vector<float> probabilities(end - beg);
-    float *probBeg = BEG(probabilities);
-    float *probEnd = END(probabilities);
-    tantan::getProbabilities(beg, end, options.maxCycleLength,
-                             probMatrixPointers,
-                             options.repeatProb, options.repeatEndProb,
-                             options.repeatOffsetProbDecay,
-                             firstGapProb, otherGapProb, probBeg);
-    if (options.outputType == options.probOut) {
+    std::vector<float> probabilities;
+    if (!probBeg) {
+      probabilities.resize(end - beg);
+      probBeg = BEG(probabilities);
+      getProbabilities(beg, end, probBeg);
+    }
+    float *probEnd = probBeg + (end - beg);
+    if (options.isCheck) checkProbabilities(beg, end, probBeg, sums);
+    if (options.outputType == options.maskOut) {
+      tantan::maskProbableLetters(beg, end, probBeg,
+				  options.minMaskProb, maskTable);
+      tantan::transformLetters(beg, end, alphabet.numbersToLetters);
+      if (record) putLettersInPlace(record, f.sequence);
+      else output << f;
+    } else if (options.outputType == options.probOut) {
       output << '>' << f.title << '\n';
       for (float *i = probBeg; i < probEnd; ++i)
         output << *i << '\n';
@@ -340,19 +585,431 @@ void processOneSequence(FastaSequence &f, std::ostream &output) {
   }
 }
 
-void processOneFile(std::istream &input, std::ostream &output) {
-  bool isFirstSequence = true;
-  FastaSequence f;
-  while (input >> f) {
-    if (isFirstSequence && !options.isProtein &&
-        isDubiousDna(BEG(f.sequence), END(f.sequence)))
-      std::cerr << "tantan: that's some funny-lookin DNA\n";
-    processOneSequence(f, output);
+void warnIfDubious(const FastaSequence &f) {
+  if (!options.isProtein && isDubiousDna(BEG(f.sequence), END(f.sequence)))
+    std::cerr << "tantan: that's some funny-lookin DNA\n";
+}
+
+// A batch of consecutive sequences, which one thread processes in one go:
+struct SequenceJob {
+  std::vector<FastaSequence> sequences;
+  size_t numOfSequences;
+  size_t numOfLetters;
+  std::vector< std::vector<float> > probabilities;  // for batchable ones
+  tantan::RepeatFinder repeatFinder;  // working memory for -f4
+  std::ostringstream output;
+  Totals sums;
+  std::exception_ptr error;  // thrown after writing the preceding output
+  size_t fileNum;  // which input file, for FileProcessor
+  char *image;  // the mapped input file, or null
+  std::vector<size_t> offsets;  // where each sequence starts in the input
+  size_t numOfDoneSequences;
+  SequenceJob() : image(0) {}
+};
+
+bool readJob(FastaReader &input, bool &isFirstSequence, SequenceJob &job) {
+  // enough letters per job that thread synchronization is negligible:
+  const size_t minLettersPerJob = 1 << 18;
+  job.numOfSequences = 0;
+  job.numOfLetters = 0;
+  while (job.numOfLetters < minLettersPerJob) {
+    if (job.numOfSequences == job.sequences.size())
+      job.sequences.resize(job.numOfSequences + 1);
+    FastaSequence &f = job.sequences[job.numOfSequences];
+    job.offsets.resize(job.numOfSequences + 2);
+    job.offsets[job.numOfSequences] = input.offset();
+    if (!input.read(f)) break;
+    if (isFirstSequence) warnIfDubious(f);
     isFirstSequence = false;
+    job.numOfLetters += f.sequence.size();
+    ++job.numOfSequences;
+  }
+  job.offsets[job.numOfSequences] = input.offset();
+  return job.numOfSequences > 0;
+}
+
+// Get the probabilities of all the short sequences in one go:
+void getBatchedProbabilities(SequenceJob &job, size_t numOfSequences) {
+  std::vector<const uchar *> begs, ends;
+  std::vector<float *> probs;
+  job.probabilities.resize(job.sequences.size());
+  for (size_t i = 0; i < numOfSequences; ++i) {
+    FastaSequence &f = job.sequences[i];
+    std::vector<float> &p = job.probabilities[i];
+    p.clear();
+    if (!isBatchable(f)) continue;
+    p.resize(f.sequence.size());
+    begs.push_back(BEG(f.sequence));
+    ends.push_back(END(f.sequence));
+    probs.push_back(BEG(p));
   }
+  tantan::getProbabilitiesOfSequences(BEG(begs), BEG(ends), begs.size(),
+				      options.maxCycleLength,
+				      probMatrixPointers,
+				      options.repeatProb,
+				      options.repeatEndProb,
+				      options.repeatOffsetProbDecay,
+				      firstGapProb, otherGapProb, BEG(probs));
+}
+
+void doJob(SequenceJob &job) {
+  job.output.str("");
+  if (options.outputType == options.probOut) job.output.precision(3);
+  job.sums.transitionCounts.resize(totals.transitionCounts.size());
+  job.sums.clear();
+  job.error = 0;
+  job.numOfDoneSequences = 0;
+  startJob();
+  size_t numOfGoodSequences = 0;
+  try {
+    for (; numOfGoodSequences < job.numOfSequences; ++numOfGoodSequences) {
+      FastaSequence &f = job.sequences[numOfGoodSequences];
+      encodeInPlace(BEG(f.sequence), END(f.sequence));
+    }
+  } catch (...) {
+    job.error = std::current_exception();
+  }
+  try {
+    getBatchedProbabilities(job, numOfGoodSequences);
+    for (size_t i = 0; i < numOfGoodSequences; ++i) {
+      std::vector<float> &p = job.probabilities[i];
+      float *probBeg = isBatchable(job.sequences[i]) ? BEG(p) : 0;
+      char *record = job.image ? job.image + job.offsets[i] : 0;
+      processOneSequence(job.sequences[i], probBeg, record,
+			 job.repeatFinder, job.output, job.sums);
+      ++job.numOfDoneSequences;
+    }
+  } catch (...) {
+    job.error = std::current_exception();
+  }
+  releaseThreads(1);
+}
+
+void writeJob(const SequenceJob &job, std::ostream &output) {
+  if (job.image) {
+    size_t beg = job.offsets[0];
+    output.write(job.image + beg, job.offsets[job.numOfDoneSequences] - beg);
+  } else {
+    output << job.output.str();
+  }
+  totals.add(job.sums);
+  if (job.error) std::rethrow_exception(job.error);
+}
+
+// Read the sequences on one thread, process them on numOfThreads
+// threads, and write the output in the original order.  Among the
+// jobs read ahead, the ones with most letters are started first.
+// If image isn't null, it is the input in memory, which gets masked
+// in place.
+void processOneFileInParallel(FastaReader &input, char *image,
+			      std::ostream &output) {
+  bool isFirstSequence = true;
+  Pipeline<SequenceJob> pipeline;
+  pipeline.run(options.numOfThreads, options.numOfThreads * 8,
+	       [&](SequenceJob &job) {
+		 job.image = image;
+		 return readJob(input, isFirstSequence, job);
+	       },
+	       doJob,
+	       [&](const SequenceJob &job) { writeJob(job, output); },
+	       [](const SequenceJob &job) { return job.numOfLetters; });
+}
+
+void processOneFile(FastaReader &input, char *image,
+		    std::ostream &output) {
+  bool isFirstSequence = true;
+  SequenceJob job;
+  job.image = image;
+  while (readJob(input, isFirstSequence, job)) {
+    doJob(job);
+    writeJob(job, output);
+  }
+}
+
+bool isStreaming() {
+  return options.lag > 0 && (options.outputType == options.maskOut ||
+			     options.outputType == options.probOut ||
+			     options.outputType == options.bedOut);
+}
+
+// The output for one sequence, written piece by piece:
+struct StreamedSequenceWriter {
+  std::string seqName;  // for BED
+  size_t position;  // number of letters written so far
+  bool isInBedRun;
+  size_t bedBeg;  // start of the current BED run
+  std::vector<uchar> letters;
+
+  StreamedSequenceWriter(const std::string &title, std::ostream &output)
+    : position(0), isInBedRun(false), bedBeg(0) {
+    if (options.outputType == options.bedOut) {
+      seqName = firstWord(title);
+      if (seqName.empty()) throw Error("missing sequence name");
+    } else {
+      output << '>' << title << '\n';
+    }
+  }
+
+  void write(const uchar *beg, const uchar *end, const float *probs,
+	     std::ostream &output) {
+    size_t length = end - beg;
+    if (options.outputType == options.maskOut) {
+      letters.assign(beg, end);
+      tantan::maskProbableLetters(BEG(letters), END(letters), probs,
+				  options.minMaskProb, maskTable);
+      tantan::transformLetters(BEG(letters), END(letters),
+			       alphabet.numbersToLetters);
+      writeFastaLetters(output, BEG(letters), END(letters), position);
+    } else if (options.outputType == options.probOut) {
+      for (size_t i = 0; i < length; ++i)
+	output << probs[i] << '\n';
+    } else {
+      for (size_t i = 0; i < length; ++i) {
+	bool isMasked = probs[i] >= options.minMaskProb;
+	if (isMasked == isInBedRun) continue;
+	if (isMasked) bedBeg = position + i;
+	else output << seqName << '\t' << bedBeg << '\t' << position + i << '\n';
+	isInBedRun = isMasked;
+      }
+    }
+    position += length;
+  }
+
+  void finish(std::ostream &output) {
+    if (options.outputType == options.maskOut) {
+      endFastaLetters(output, position);
+    } else if (options.outputType == options.bedOut && isInBedRun) {
+      output << seqName << '\t' << bedBeg << '\t' << position << '\n';
+    }
+  }
+};
+
+// Masks each sequence while reading it, in pieces of options.lag
+// letters, each with the next options.lag letters as look-ahead.  So
+// the output lags behind the input by at most 2 * options.lag
+// letters, and the memory doesn't depend on the sequence length.
+void processOneInputByStreaming(std::istream &input, std::ostream &output) {
+  size_t lag = options.lag;
+  size_t maxBefore = options.maxCycleLength;
+  std::string title;
+  std::vector<uchar> seq;  // the letters from seqOffset onwards
+  std::vector<float> probs;
+  std::vector<double> forwardState(2 * maxBefore);
+
+  while (readFastaTitle(input, title)) {
+    StreamedSequenceWriter writer(title, output);
+    size_t seqOffset = 0;
+    seq.clear();
+    bool isMore = true;
+    while (isMore) {
+      size_t done = writer.position;
+      size_t oldSize = seq.size();
+      isMore = readFastaLetters(input, seq, done - seqOffset + 2 * lag);
+      encodeInPlace(BEG(seq) + oldSize, END(seq));
+      uchar *contextBeg = BEG(seq);
+      uchar *beg = contextBeg + (done - seqOffset);
+      uchar *end = END(seq);
+      uchar *mid = isMore ? beg + lag : end;
+      if (mid == beg) break;
+      probs.resize(mid - beg);
+      tantan::getProbabilitiesWithLookahead(contextBeg, beg, mid, end,
+					    options.maxCycleLength,
+					    probMatrixPointers,
+					    options.repeatProb,
+					    options.repeatEndProb,
+					    options.repeatOffsetProbDecay,
+					    firstGapProb, otherGapProb,
+					    BEG(forwardState), BEG(probs));
+      writer.write(beg, mid, BEG(probs), output);
+      output.flush();
+      done = writer.position;
+      size_t newOffset = done - std::min(done, maxBefore);
+      seq.erase(seq.begin(), seq.begin() + (newOffset - seqOffset));
+      seqOffset = newOffset;
+    }
+    writer.finish(output);
+  }
+
+  if (!input.eof()) throw Error("--lag needs FASTA input");
+}
+
+void processOneInput(FastaReader &input, char *image,
+		     std::ostream &output) {
+  if (options.numOfThreads > 1)
+    processOneFileInParallel(input, image, output);
+  else
+    processOneFile(input, image, output);
+}
+
+void processOneInput(std::istream &in, std::ostream &output) {
+  if (isStreaming()) {
+    processOneInputByStreaming(in, output);
+  } else {
+    FastaReader input(in);
+    processOneInput(input, 0, output);
+  }
+}
+
+bool isMaskingInPlace() {
+  return options.isMapped && options.outputType == options.maskOut &&
+    !isStreaming();
+}
+
+// Maps the file, unless it is standard input, or not a regular file,
+// or gzipped:
+bool mapFile(MappedFile &m, const std::string &fileName) {
+  if (fileName == "-" || !m.open(fileName.c_str())) return false;
+  const char *b = m.begin();
+  if (m.end() - b > 1 && uchar(b[0]) == 0x1f && uchar(b[1]) == 0x8b) {
+    m.close();
+    return false;
+  }
+  return true;
+}
+
+std::string outputFileName(std::string inputFileName) {
+  if (inputFileName == "-") return inputFileName;
+  size_t s = inputFileName.size();
+  if (s > 3 && inputFileName.compare(s - 3, 3, ".gz") == 0)
+    inputFileName.resize(s - 3);
+  return inputFileName + options.outputSuffix;
+}
+
+void setPrecision(std::ostream &output) {
+  if (options.outputType == options.probOut) output.precision(3);
+}
+
+void closeOut(std::ofstream &file, const std::string &fileName) {
+  if (!file.is_open()) return;
+  file.close();
+  if (!file) throw std::runtime_error("can't write file: " + fileName);
+}
+
+void processOneInput(const char *fileName) {
+  MappedFile mappedFile;
+  izstream z;
+  std::istream *in = 0;
+  if (!isMaskingInPlace() || !mapFile(mappedFile, fileName))
+    in = &openIn(fileName, z, options.numOfThreads);
+  std::string outName;
+  std::ofstream file;
+  std::ostream *output = &std::cout;
+  if (options.outputSuffix) {
+    outName = outputFileName(fileName);
+    output = &openOut(outName, file);
+    setPrecision(*output);
+  }
+  if (in) {
+    processOneInput(*in, *output);
+  } else {
+    FastaReader input(mappedFile.begin(), mappedFile.end());
+    processOneInput(input, mappedFile.begin(), *output);
+  }
+  closeOut(file, outName);
+}
+
+// Reads the sequences of several files in turn, processes them on
+// numOfThreads threads, and writes the output in the original order
+// (to stdout, or with --suffix to each file's own output file).  The
+// threads work on all the files, so they don't wait for each other at
+// the end of each file.
+class FileProcessor {
+public:
+  void run(char **fileNames, size_t numOfFiles);
+
+private:
+  char **fileNames;
+  size_t numOfFiles;
+  std::vector<MappedFile> mappedFiles;  // for --mmap
+
+  // for reading:
+  size_t readFileNum;  // the file being read
+  izstream z;
+  std::unique_ptr<FastaReader> input;  // null between files
+  bool isFirstSequence;
+
+  // for writing:
+  size_t writeFileNum;  // the file being written
+  std::string outName;
+  std::ofstream file;
+  std::ostream *output;
+
+  bool readOneJob(SequenceJob &job);
+  void startOutput();
+  void endOutput();
+  void writeOneJob(const SequenceJob &job);
+};
+
+void FileProcessor::run(char **fileNames, size_t numOfFiles) {
+  this->fileNames = fileNames;
+  this->numOfFiles = numOfFiles;
+  mappedFiles = std::vector<MappedFile>(numOfFiles);
+  readFileNum = 0;
+  writeFileNum = 0;
+  startOutput();
+  Pipeline<SequenceJob> pipeline;
+  pipeline.run(options.numOfThreads, options.numOfThreads * 8,
+	       [this](SequenceJob &job) { return readOneJob(job); },
+	       doJob,
+	       [this](const SequenceJob &job) { writeOneJob(job); },
+	       [](const SequenceJob &job) { return job.numOfLetters; });
+  for (;;) {
+    endOutput();
+    if (++writeFileNum == numOfFiles) break;
+    startOutput();
+  }
+}
+
+bool FileProcessor::readOneJob(SequenceJob &job) {
+  for (;;) {
+    if (!input) {
+      if (readFileNum == numOfFiles) return false;
+      const char *fileName = fileNames[readFileNum];
+      MappedFile &m = mappedFiles[readFileNum];
+      if (isMaskingInPlace() && mapFile(m, fileName))
+	input.reset(new FastaReader(m.begin(), m.end()));
+      else
+	input.reset(new FastaReader(openIn(fileName, z,
+					   options.numOfThreads)));
+      isFirstSequence = true;
+    }
+    job.fileNum = readFileNum;
+    job.image = mappedFiles[readFileNum].begin();
+    if (readJob(*input, isFirstSequence, job)) return true;
+    input.reset();
+    if (z.is_open()) z.close();
+    ++readFileNum;
+  }
+}
+
+void FileProcessor::startOutput() {
+  output = &std::cout;
+  if (options.outputSuffix) {
+    outName = outputFileName(fileNames[writeFileNum]);
+    output = &openOut(outName, file);
+    setPrecision(*output);
+  }
+}
+
+void FileProcessor::endOutput() {
+  closeOut(file, outName);
+  mappedFiles[writeFileNum].close();
+}
+
+void FileProcessor::writeOneJob(const SequenceJob &job) {
+  while (writeFileNum < job.fileNum) {
+    endOutput();
+    ++writeFileNum;
+    startOutput();
+  }
+  writeJob(job, *output);
 }
 
 void writeCounts(std::ostream &output) {
+  std::vector<double> transitionCounts;
+  for (size_t i = 0; i < totals.transitionCounts.size(); ++i)
+    transitionCounts.push_back(totals.transitionCounts[i].value());
+  double transitionTotal = totals.transitionTotal.value();
   double bg2bg = transitionCounts[0];
 
   output << "#period" << '\t' << "estimated number of tracts" << '\n';
@@ -406,24 +1063,34 @@ try {
   if (!options.isPreserveLowercase) alphabet.makeCaseInsensitive();
 
   if (options.outputType == options.countOut)
-    transitionCounts.resize(options.maxCycleLength + 1);
+    totals.transitionCounts.resize(options.maxCycleLength + 1);
+  totals.clear();
 
   std::ostream &output = std::cout;
-  if (options.outputType == options.probOut)
-    output.precision(3);
+  setPrecision(output);
 
-  if (options.indexOfFirstNonOptionArgument == argc)
-    processOneFile(std::cin, output);
+  int numOfFiles = argc - options.indexOfFirstNonOptionArgument;
+  char **fileNames = argv + options.indexOfFirstNonOptionArgument;
 
-  for (int i = options.indexOfFirstNonOptionArgument; i < argc; ++i) {
-    izstream z;
-    std::istream &input = openIn(argv[i], z);
-    processOneFile(input, output);
+  if (numOfFiles == 0) {
+    processOneInput(std::cin, output);
+  } else if (options.numOfThreads > 1 && !isStreaming()) {
+    FileProcessor processor;
+    processor.run(fileNames, numOfFiles);
+  } else {
+    for (int i = 0; i < numOfFiles; ++i)
+      processOneInput(fileNames[i]);
   }
 
   if (options.outputType == options.countOut)
     writeCounts(output);
 
+  if (options.isCheck)
+    std::cerr << "tantan: maximum difference from basic calculation: "
+	      << totals.maxProbDifference << "\n"
+	      << "tantan: letters masked differently: "
+	      << totals.maskDifferences << "\n";
+
   return EXIT_SUCCESS;
 }
 catch( const std::bad_alloc& e ) {  // bad_alloc::what() may be unfriendly
@@ -10,10 +10,6 @@
 
 namespace tantan {
 
-static double max3(double x, double y, double z) {
-  return std::max(std::max(x, y), z);
-}
-
 static double myLog(double x) {
   return x > 0 ? log(x) : -HUGE_VAL;
 }
@@ -51,13 +47,13 @@ static unsigned minStoredPositions(const uchar *beg, const uchar *end) {
   return t + 1;
 }
 
-void RepeatFinder::init(int maxRepeatOffset,
-			const const_double_ptr *substitutionMatrix,
-			double repeatProb,
-			double repeatEndProb,
-			double repeatOffsetProbDecay,
-			double firstGapProb,
-			double otherGapProb) {
+void RepeatFinderModel::init(int maxRepeatOffset,
+			     const const_double_ptr *substitutionMatrix,
+			     double repeatProb,
+			     double repeatEndProb,
+			     double repeatOffsetProbDecay,
+			     double firstGapProb,
+			     double otherGapProb) {
   assert(maxRepeatOffset > 0);
   this->maxRepeatOffset = maxRepeatOffset;
   this->substitutionMatrix = substitutionMatrix;
@@ -76,124 +72,150 @@ void RepeatFinder::init(int maxRepeatOffset,
   b2fLast = myLog(repeatProb * firstRepeatOffsetProb(x, maxRepeatOffset));
 
   dpScoresPerLetter = numOfDpScoresPerLetter(maxRepeatOffset, endGapScore);
+  isIntegers = false;
 }
 
-void RepeatFinder::initializeBackwardScores() {
-  scoresPtr[0] = b2b;
-  std::fill_n(scoresPtr + 1, maxRepeatOffset, f2b);
-  if (endGapScore > -HUGE_VAL) {
-    std::fill_n(scoresPtr + 1 + maxRepeatOffset, maxRepeatOffset-1, -HUGE_VAL);
-  }
+static int intScore(double x, double scale) {
+  double y = floor(x * scale + 0.5);
+  return y < SHRT_MIN ? SHRT_MIN : y > SHRT_MAX ? SHRT_MAX : y;
 }
 
-void RepeatFinder::calcBackwardTransitionScoresWithGaps() {
-  double toBackground = f2b + scoresPtr[0];
-  double *foregroundPtr = scoresPtr + 1;
-  double f = *foregroundPtr;
-  double toForeground = f;
-
-  double *insertionPtr = scoresPtr + 1 + maxRepeatOffset;
-  double i = *insertionPtr;
-  *foregroundPtr = max3(toBackground, f2f1 + f, i);
-  double d = endGapScore + f;
-  ++foregroundPtr;
-  toForeground += b2fGrowth;
-
-  while (foregroundPtr < scoresPtr + maxRepeatOffset) {
-    f = *foregroundPtr;
-    toForeground = std::max(toForeground, f);
-    i = *(insertionPtr + 1);
-    *foregroundPtr = max3(toBackground, f2f2 + f, std::max(i, d));
-    double oneGapScore_f = oneGapScore + f;
-    *insertionPtr = std::max(oneGapScore_f, g2g + i);
-    d = std::max(oneGapScore_f, g2g + d);
-    ++foregroundPtr;
-    ++insertionPtr;
-    toForeground += b2fGrowth;
+void RepeatFinderModel::initIntegers(int alphabetSize) {
+  // The sum of the transition scores' sizes, plus the best emission
+  // score, bounds the spread of scores in one DP row:
+  const double scores[] = {b2b, f2b, g2g, oneGapScore, endGapScore,
+			   f2f0, f2f1, f2f2, b2fGrowth, b2fLast};
+  double range = 0;
+  for (int i = 0; i < alphabetSize; ++i)
+    for (int j = 0; j < alphabetSize; ++j)
+      range = std::max(range, substitutionMatrix[i][j]);
+  for (size_t i = 0; i < sizeof scores / sizeof *scores; ++i)
+    if (scores[i] > -HUGE_VAL) range += fabs(scores[i]);
+  if (!(range > 0)) range = 1;
+
+  isIntegers = true;
+  intScale = intScoreRange / range;
+  double k = intScale;
+  RepeatFinderScores<int> &t = intScores;
+  t.b2b = intScore(b2b, k);
+  t.f2b = intScore(f2b, k);
+  t.g2g = intScore(g2g, k);
+  t.oneGapScore = intScore(oneGapScore, k);
+  t.endGapScore = intScore(endGapScore, k);
+  t.f2f0 = intScore(f2f0, k);
+  t.f2f1 = intScore(f2f1, k);
+  t.f2f2 = intScore(f2f2, k);
+  t.b2fGrowth = intScore(b2fGrowth, k);
+  t.b2fLast = intScore(b2fLast, k);
+
+  // At least 16 columns, for table lookups with byte shuffles:
+  int rowSize = std::max(alphabetSize, 16);
+  intMatrix.assign(alphabetSize * rowSize, SHRT_MIN);
+  intMatrixRows.resize(alphabetSize);
+  for (int i = 0; i < alphabetSize; ++i) {
+    intMatrixRows[i] = &intMatrix[i * rowSize];
+    for (int j = 0; j < alphabetSize; ++j) {
+      // An emission score below -2 * range never gets on the best
+      // path, so we can cap it, leaving room for the other scores in
+      // 16 bits:
+      double x = std::max(substitutionMatrix[i][j], -2 * range);
+      intMatrix[i * rowSize + j] = intScore(x, k);
+    }
   }
 
-  f = *foregroundPtr;
-  toForeground = std::max(toForeground, f);
-  *foregroundPtr = max3(toBackground, f2f1 + f, d);
-  *insertionPtr = endGapScore + f;
+  // Rounded separately, because rounding errors in b2fGrowth would
+  // add up:
+  b2fIntScores.resize(maxRepeatOffset + 1);
+  for (int i = 1; i <= maxRepeatOffset; ++i) {
+    double x = b2fLast + (maxRepeatOffset - i) * b2fGrowth;
+    b2fIntScores[i] = intScore(x, k);
+  }
+}
 
-  scoresPtr[0] = std::max(b2b + scoresPtr[0], b2fLast + toForeground);
+static void getScores(const RepeatFinderModel &model,
+		      RepeatFinderScores<double> &s,
+		      const const_double_ptr *&matrix, const short *&b2f) {
+  s = model;
+  matrix = model.substitutionMatrix;
+  b2f = 0;
 }
 
-void RepeatFinder::calcEmissionScores() {
-  const double *matrixRow = substitutionMatrix[*seqPtr];
-  double *oldScores = scoresPtr - dpScoresPerLetter;
-  int maxOffset = maxOffsetInTheSequence();
-  int i = 1;
+// The integer b2f scores come from a table, instead of b2fGrowth:
+static void getScores(const RepeatFinderModel &model,
+		      RepeatFinderScores<int> &s,
+		      const short *const *&matrix, const short *&b2f) {
+  s = model.intScores;
+  s.b2fGrowth = 0;
+  matrix = &model.intMatrixRows[0];
+  b2f = &model.b2fIntScores[0];
+}
 
-  scoresPtr[0] = oldScores[0];
+static double minusInfinity(double) { return -HUGE_VAL; }
 
-  for (; i <= maxOffset; ++i) {
-    scoresPtr[i] = oldScores[i] + matrixRow[seqPtr[-i]];
-  }
+static short minusInfinity(short) { return SHRT_MIN; }
 
-  for (; i <= maxRepeatOffset; ++i) {
-    scoresPtr[i] = -HUGE_VAL;
-  }
+static int minusInfinity(int) { return INT_MIN / 2; }
 
-  std::copy(oldScores + i, scoresPtr, scoresPtr + i);
+static void calcScores(const RepeatFinderModel &model,
+		       const uchar *seqBeg, const uchar *seqPtr,
+		       const double *oldScores, double *scores) {
+  calcRepeatFinderScores(model, seqBeg, seqPtr, oldScores, scores);
 }
 
-void RepeatFinder::calcScoresForOneSequencePosition() {
-  if (endGapScore > -HUGE_VAL) {
-    calcEmissionScores();
-    calcBackwardTransitionScoresWithGaps();
-    return;
-  }
-
-  double *oldScores = scoresPtr - dpScoresPerLetter;
-  double toBackground = f2b + oldScores[0];
-  const double *matrixRow = substitutionMatrix[*seqPtr];
-  int maxOffset = maxOffsetInTheSequence();
-  double toForeground = -HUGE_VAL;
-  int i = 1;
-
-  for (; i <= maxOffset; ++i) {
-    double f = oldScores[i] + matrixRow[seqPtr[-i]];
-    toForeground = std::max(toForeground + b2fGrowth, f);
-    scoresPtr[i] = std::max(toBackground, f2f0 + f);
-  }
+static void calcScores(const RepeatFinderModel &model,
+		       const uchar *seqBeg, const uchar *seqPtr,
+		       const short *oldScores, short *scores) {
+  calcRepeatFinderIntScores(model, seqBeg, seqPtr, oldScores, scores);
+}
 
-  for (; i <= maxRepeatOffset; ++i) {
-    toForeground += b2fGrowth;
-    scoresPtr[i] = toBackground;
-  }
 
-  std::copy(oldScores + i, scoresPtr, scoresPtr + i);
+template <typename T, typename Score>
+void BasicRepeatFinder<T, Score>::initializeBackwardScores() {
+  scoresPtr[0] = s.b2b;
+  std::fill_n(scoresPtr + 1, maxRepeatOffset, s.f2b);
+  std::fill(scoresPtr + 1 + maxRepeatOffset, scoresPtr + dpScoresPerLetter,
+	    minusInfinity(T()));
+  std::fill(scoresPtr + dpScoresPerLetter, scoresPtr + rowSize, 0);
+}
 
-  scoresPtr[0] = std::max(b2b + oldScores[0], b2fLast + toForeground);
+template <typename T, typename Score>
+void BasicRepeatFinder<T, Score>::calcScoresForOneSequencePosition() {
+  calcScores(*model, seqBeg, seqPtr, scoresPtr - rowSize, scoresPtr);
 }
 
-void RepeatFinder::makeCheckpoint() {
-  checkpoint += dpScoresPerLetter;
-  std::copy(scoresPtr - dpScoresPerLetter, scoresPtr, checkpoint);
-  scoresPtr = checkpoint + dpScoresPerLetter;
+template <typename T, typename Score>
+void BasicRepeatFinder<T, Score>::makeCheckpoint() {
+  checkpoint += rowSize;
+  std::copy(scoresPtr - rowSize, scoresPtr, checkpoint);
+  scoresPtr = checkpoint + rowSize;
   assert(scoresPtr < scoresEnd);
 }
 
-void RepeatFinder::redoCheckpoint() {
-  seqPtr += (scoresEnd - scoresPtr) / dpScoresPerLetter;
+template <typename T, typename Score>
+void BasicRepeatFinder<T, Score>::redoCheckpoint() {
+  seqPtr += (scoresEnd - scoresPtr) / rowSize;
   while (scoresPtr < scoresEnd) {
     --seqPtr;
     calcScoresForOneSequencePosition();
-    scoresPtr += dpScoresPerLetter;
+    scoresPtr += rowSize;
   }
-  scoresPtr -= dpScoresPerLetter;
-  checkpoint -= dpScoresPerLetter;
+  scoresPtr -= rowSize;
+  checkpoint -= rowSize;
 }
 
-double RepeatFinder::calcBestPathScore(const uchar *seqBeg,
-				       const uchar *seqEnd) {
+template <typename T, typename Score>
+double BasicRepeatFinder<T, Score>::calcBestPathScore(
+    const RepeatFinderModel &model, const uchar *seqBeg, const uchar *seqEnd) {
+  this->model = &model;
+  getScores(model, s, matrix, b2fTable);
+  maxRepeatOffset = model.maxRepeatOffset;
+  dpScoresPerLetter = model.dpScoresPerLetter;
+  rowSize = dpScoresPerLetter + (sizeof(T) < sizeof(Score));
   this->seqBeg = seqBeg;
   this->seqEnd = seqEnd;
 
   unsigned long numOfStoredPositions = minStoredPositions(seqBeg, seqEnd);
-  unsigned long numOfScores = numOfStoredPositions * dpScoresPerLetter;
+  unsigned long numOfScores = numOfStoredPositions * rowSize;
   assert(numOfStoredPositions > 0);
   assert(numOfScores > 0);
   dpScores.resize(numOfScores);
@@ -203,27 +225,32 @@ double RepeatFinder::calcBestPathScore(const uchar *seqBeg,
   seqPtr = seqEnd;
 
   initializeBackwardScores();
+  double totalShift = 0;
 
   while (seqPtr > seqBeg) {
     --seqPtr;
-    scoresPtr += dpScoresPerLetter;
+    scoresPtr += rowSize;
     if (scoresPtr == scoresEnd) makeCheckpoint();
     calcScoresForOneSequencePosition();
+    totalShift += shift(scoresPtr);
   }
 
   state = 0;
-  return scoresPtr[0];
+  double score = totalShift + scoresPtr[0];
+  return model.isIntegers ? score / model.intScale : score;
 }
 
-int RepeatFinder::offsetWithMaxScore() const {
-  const double *matrixRow = substitutionMatrix[*seqPtr];
+template <typename T, typename Score>
+int BasicRepeatFinder<T, Score>::offsetWithMaxScore() const {
+  const T *matrixRow = matrix[*seqPtr];
   int maxOffset = maxOffsetInTheSequence();
   int bestOffset = 0;
-  double toForeground = -HUGE_VAL;
+  Score toForeground = minusInfinity(Score());
 
   for (int i = 1; i <= maxOffset; ++i) {
-    toForeground += b2fGrowth;
-    double f = scoreWithEmission(matrixRow, i);
+    toForeground += s.b2fGrowth;
+    Score f = scoreWithEmission(matrixRow, i);
+    if (b2fTable) f += b2fTable[i];
     if (f > toForeground) {
       toForeground = f;
       bestOffset = i;
@@ -233,17 +260,18 @@ int RepeatFinder::offsetWithMaxScore() const {
   return bestOffset;
 }
 
-int RepeatFinder::deletionWithMaxScore() const {
-  const double *matrixRow = substitutionMatrix[*seqPtr];
+template <typename T, typename Score>
+int BasicRepeatFinder<T, Score>::deletionWithMaxScore() const {
+  const T *matrixRow = matrix[*seqPtr];
   int bestOffset = 1;
-  double f = scoreWithEmission(matrixRow, 1);
-  double d = endGapScore + f;
+  Score f = scoreWithEmission(matrixRow, 1);
+  Score d = s.endGapScore + f;
 
   for (int i = 2; i < state; ++i) {
-    d += g2g;
+    d += s.g2g;
     f = scoreWithEmission(matrixRow, i);
-    if (oneGapScore + f > d) {
-      d = oneGapScore + f;
+    if (s.oneGapScore + f > d) {
+      d = s.oneGapScore + f;
       bestOffset = i;
     }
   }
@@ -251,23 +279,24 @@ int RepeatFinder::deletionWithMaxScore() const {
   return bestOffset;
 }
 
-int RepeatFinder::nextState() {
-  double maxScore = scoresPtr[state];
+template <typename T, typename Score>
+int BasicRepeatFinder<T, Score>::nextState() {
+  Score maxScore = scoresPtr[state] + shift(scoresPtr);
   if (scoresPtr == checkpoint) redoCheckpoint();
-  scoresPtr -= dpScoresPerLetter;
+  scoresPtr -= rowSize;
 
   if (state == 0) {
-    if (b2b + scoresPtr[0] < maxScore) state = offsetWithMaxScore();
+    if (s.b2b + scoresPtr[0] < maxScore) state = offsetWithMaxScore();
   } else if (state <= maxRepeatOffset) {
-    if (f2b + scoresPtr[0] >= maxScore) {
+    if (s.f2b + scoresPtr[0] >= maxScore) {
       state = 0;
-    } else if (endGapScore > -HUGE_VAL) {
-      double f = scoreWithEmission(substitutionMatrix[*seqPtr], state);
+    } else if (model->endGapScore > -HUGE_VAL) {
+      Score f = scoreWithEmission(matrix[*seqPtr], state);
       if (state == 1) {
-	if (f2f1 + f < maxScore) state += maxRepeatOffset;
+	if (s.f2f1 + f < maxScore) state += maxRepeatOffset;
       } else if (state == maxRepeatOffset) {
-	if (f2f1 + f < maxScore) state = deletionWithMaxScore();
-      } else if (f2f2 + f < maxScore) {
+	if (s.f2f1 + f < maxScore) state = deletionWithMaxScore();
+      } else if (s.f2f2 + f < maxScore) {
 	if (scoresPtr[state + maxRepeatOffset] >= maxScore) {
 	  state += maxRepeatOffset;
 	} else {
@@ -277,7 +306,7 @@ int RepeatFinder::nextState() {
     }
   } else {
     ++state;
-    if (state == dpScoresPerLetter || g2g + scoresPtr[state] < maxScore) {
+    if (state == dpScoresPerLetter || s.g2g + scoresPtr[state] < maxScore) {
       state -= maxRepeatOffset;
     }
   }
@@ -286,4 +315,7 @@ int RepeatFinder::nextState() {
   return state;
 }
 
+template class BasicRepeatFinder<double, double>;
+template class BasicRepeatFinder<short, int>;
+
 }
@@ -7,10 +7,25 @@
 // substitutionMatrix should be a *log* likelihood ratio matrix:
 // substitutionMatrix[x][y] = lambda * scoringMatrix[x][y].
 
-// Usage: first call init.  Then call calcBestPathScore, which runs
-// the Viterbi algorithm backwards from the end to the start of the
-// sequence.  Finally, call nextState once per sequence letter, to get
-// the "state" of each letter from start to end.
+// Usage: first call RepeatFinderModel::init.  Then call
+// RepeatFinder::calcBestPathScore, which runs the Viterbi algorithm
+// backwards from the end to the start of the sequence.  Finally, call
+// nextState once per sequence letter, to get the "state" of each
+// letter from start to end.
+
+// A RepeatFinderModel is not modified after initialization, so several threads
+// can share it.  A RepeatFinder holds the working memory for one
+// sequence at a time, so each thread needs its own.
+
+// Optionally, call RepeatFinderModel::initIntegers after init: then
+// RepeatFinder uses 16-bit integer scores, i.e. the log probabilities
+// times intScale, rounded.  This is faster, and needs a quarter of
+// the memory, but the rounding can change the result.  The
+// tie-breaking rules are the same, but rounding makes ties more
+// likely: e.g. two repeat offsets with different scores may get equal
+// integer scores, and then the lower offset is chosen.  So a repeat's
+// period, or its boundaries, can differ from the double-precision
+// result.  This is rare for DNA, but less rare for protein.
 
 // state = 0: non-repeat.
 // 0 < state <= maxRepeatOffset: tandem repeat with period = state.
@@ -26,7 +41,21 @@ namespace tantan {
 typedef unsigned char uchar;
 typedef const double *const_double_ptr;
 
-class RepeatFinder {
+// The model's log probabilities, as doubles or scaled integers:
+template <typename T> struct RepeatFinderScores {
+  T b2b;
+  T f2b;
+  T g2g;
+  T oneGapScore;
+  T endGapScore;
+  T f2f0;
+  T f2f1;
+  T f2f2;
+  T b2fGrowth;
+  T b2fLast;
+};
+
+class RepeatFinderModel : public RepeatFinderScores<double> {
 public:
   void init(int maxRepeatOffset,
 	    const const_double_ptr *substitutionMatrix,
@@ -36,31 +65,51 @@ public:
 	    double firstGapProb,
 	    double otherGapProb);
 
-  double calcBestPathScore(const uchar *seqBeg, const uchar *seqEnd);
-
-  int nextState();
+  // alphabetSize: substitutionMatrix is alphabetSize x alphabetSize
+  void initIntegers(int alphabetSize);
 
-private:
+  // The substitution matrix, which calcRepeatFinderScores reads:
   const const_double_ptr *substitutionMatrix;
 
-  double b2b;
-  double f2b;
-  double g2g;
-  double oneGapScore;
-  double endGapScore;
-  double f2f0;
-  double f2f1;
-  double f2f2;
-  double b2fGrowth;
-  double b2fLast;
+  int maxRepeatOffset;
+  int dpScoresPerLetter;
 
+  // For the 16-bit integer scores, which calcRepeatFinderIntScores
+  // reads.  The scores in one DP row are within about intScoreRange of
+  // each other, and each row is shifted so its background score is 0.
+  // So the sums of one score and one step are within 2 * intScoreRange,
+  // which fits in 16 bits.
+  enum { intScoreRange = 16383 };
+  bool isIntegers;
+  double intScale;
+  RepeatFinderScores<int> intScores;
+  std::vector<short> intMatrix;
+  std::vector<const short *> intMatrixRows;
+  std::vector<short> b2fIntScores;  // b2fLast + (maxRepeatOffset-i) * growth
+};
+
+// The Viterbi algorithm with T = double or short scores, in which
+// we do arithmetic with type Score = double or int
+template <typename T, typename Score> class BasicRepeatFinder {
+public:
+  double calcBestPathScore(const RepeatFinderModel &model,
+			   const uchar *seqBeg, const uchar *seqEnd);
+
+  int nextState();
+
+private:
+  const RepeatFinderModel *model;
+  RepeatFinderScores<Score> s;
+  const T *const *matrix;
+  const short *b2fTable;  // b2f scores for shorts, else null
   int maxRepeatOffset;
   int dpScoresPerLetter;
+  int rowSize;  // for shorts, each DP row ends with its shift
 
-  std::vector<double> dpScores;
-  double *scoresPtr;
-  double *scoresEnd;
-  double *checkpoint;
+  std::vector<T> dpScores;
+  T *scoresPtr;
+  T *scoresEnd;
+  T *checkpoint;
 
   const uchar *seqBeg;
   const uchar *seqEnd;
@@ -68,8 +117,6 @@ private:
   int state;
 
   void initializeBackwardScores();
-  void calcBackwardTransitionScoresWithGaps();
-  void calcEmissionScores();
   void calcScoresForOneSequencePosition();
   void makeCheckpoint();
   void redoCheckpoint();
@@ -84,11 +131,51 @@ private:
     return isNearSeqBeg() ? (seqPtr - seqBeg) : maxRepeatOffset;
   }
 
-  double scoreWithEmission(const double *matrixRow, int offset) const {
-    return scoresPtr[offset] + matrixRow[seqPtr[-offset]];
+  // The amount that was subtracted from this row's scores
+  Score shift(const T *scores) const {
+    return rowSize > dpScoresPerLetter ? scores[dpScoresPerLetter] : 0;
+  }
+
+  Score scoreWithEmission(const T *matrixRow, int offset) const {
+    return Score(scoresPtr[offset]) + matrixRow[seqPtr[-offset]];
   }
 };
 
+class RepeatFinder {
+public:
+  double calcBestPathScore(const RepeatFinderModel &model,
+			   const uchar *seqBeg, const uchar *seqEnd) {
+    isIntegers = model.isIntegers;
+    return isIntegers ? ints.calcBestPathScore(model, seqBeg, seqEnd)
+      :              doubles.calcBestPathScore(model, seqBeg, seqEnd);
+  }
+
+  int nextState() {
+    return isIntegers ? ints.nextState() : doubles.nextState();
+  }
+
+private:
+  bool isIntegers;
+  BasicRepeatFinder<double, double> doubles;
+  BasicRepeatFinder<short, int> ints;
+};
+
+// The inner loop of RepeatFinder: it calculates the Viterbi scores at
+// seqPtr, from the scores at seqPtr+1 (oldScores).  It is in tantan.cc,
+// which is compiled for several SIMD instruction sets.
+
+void calcRepeatFinderScores(const RepeatFinderModel &model,
+			    const uchar *seqBeg, const uchar *seqPtr,
+			    const double *oldScores, double *scores);
+
+// The same with 16-bit integer scores.  It also sets
+// scores[model.dpScoresPerLetter] to the amount it subtracted from the
+// scores.
+
+void calcRepeatFinderIntScores(const RepeatFinderModel &model,
+			       const uchar *seqBeg, const uchar *seqPtr,
+			       const short *oldScores, short *scores);
+
 }
 
 #endif
@@ -0,0 +1,281 @@
+// Copyright 2026 Martin C. Frith
+
+#include "tantan_simd.hh"
+
+#include <string.h>
+
+namespace tantan {
+
+#if defined __x86_64__ || defined __i386__
+
+static bool isSupported(const SimdBackend &b) {
+  __builtin_cpu_init();
+  if (&b == &avx512::backend)
+    return __builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx2");
+  if (&b == &avx2::backend) return __builtin_cpu_supports("avx2");
+  if (&b == &sse4::backend) return __builtin_cpu_supports("sse4.1");
+  return true;
+}
+
+// best first:
+static const SimdBackend *const backends[] = {
+  &avx512::backend, &avx2::backend, &sse4::backend, &scalar::backend, 0
+};
+
+#else
+
+static bool isSupported(const SimdBackend &) { return true; }
+
+static const SimdBackend *const backends[] = { &native::backend, 0 };
+
+#endif
+
+static const SimdBackend *bestBackend() {
+  const SimdBackend *const *b = backends;
+  while (!isSupported(**b)) ++b;
+  return *b;
+}
+
+static const SimdBackend *&backend() {
+  static const SimdBackend *b = bestBackend();
+  return b;
+}
+
+void setSinglePrecision(bool isSingle) {
+  for (const SimdBackend *const *b = backends; *b; ++b)
+    (*b)->setSinglePrecision(isSingle);
+}
+
+const char *simdName() {
+  return backend()->name;
+}
+
+bool setSimd(const char *name) {
+  if (strcmp(name, "auto") == 0) {
+    backend() = bestBackend();
+    return true;
+  }
+  for (const SimdBackend *const *b = backends; *b; ++b) {
+    if (strcmp(name, (*b)->name) == 0) {
+      if (!isSupported(**b)) return false;
+      backend() = *b;
+      return true;
+    }
+  }
+  return false;
+}
+
+void maskSequences(uchar *seqBeg,
+                   uchar *seqEnd,
+                   int maxRepeatOffset,
+                   const const_double_ptr *likelihoodRatioMatrix,
+                   double repeatProb,
+                   double repeatEndProb,
+                   double repeatOffsetProbDecay,
+                   double firstGapProb,
+                   double otherGapProb,
+                   double minMaskProb,
+                   const uchar *maskTable) {
+  backend()->maskSequences(seqBeg, seqEnd, maxRepeatOffset,
+                           likelihoodRatioMatrix, repeatProb, repeatEndProb,
+                           repeatOffsetProbDecay, firstGapProb, otherGapProb,
+                           minMaskProb, maskTable);
+}
+
+void maskSequencesWithCheckpoints(uchar *seqBeg,
+                                  uchar *seqEnd,
+                                  int maxRepeatOffset,
+                                  const const_double_ptr
+                                  *likelihoodRatioMatrix,
+                                  double repeatProb,
+                                  double repeatEndProb,
+                                  double repeatOffsetProbDecay,
+                                  double firstGapProb,
+                                  double otherGapProb,
+                                  double minMaskProb,
+                                  const uchar *maskTable) {
+  backend()->maskSequencesWithCheckpoints(seqBeg, seqEnd, maxRepeatOffset,
+                                          likelihoodRatioMatrix, repeatProb,
+                                          repeatEndProb,
+                                          repeatOffsetProbDecay,
+                                          firstGapProb, otherGapProb,
+                                          minMaskProb, maskTable);
+}
+
+void getProbabilities(const uchar *seqBeg,
+                      const uchar *seqEnd,
+                      int maxRepeatOffset,
+                      const const_double_ptr *likelihoodRatioMatrix,
+                      double repeatProb,
+                      double repeatEndProb,
+                      double repeatOffsetProbDecay,
+                      double firstGapProb,
+                      double otherGapProb,
+                      float *probabilities) {
+  backend()->getProbabilities(seqBeg, seqEnd, maxRepeatOffset,
+                              likelihoodRatioMatrix, repeatProb,
+                              repeatEndProb, repeatOffsetProbDecay,
+                              firstGapProb, otherGapProb, probabilities);
+}
+
+void getProbabilitiesOfSequences(const uchar *const *seqBegs,
+                                 const uchar *const *seqEnds,
+                                 size_t numOfSequences,
+                                 int maxRepeatOffset,
+                                 const const_double_ptr
+                                 *likelihoodRatioMatrix,
+                                 double repeatProb,
+                                 double repeatEndProb,
+                                 double repeatOffsetProbDecay,
+                                 double firstGapProb,
+                                 double otherGapProb,
+                                 float *const *probabilities) {
+  backend()->getProbabilitiesOfSequences(seqBegs, seqEnds, numOfSequences,
+                                         maxRepeatOffset,
+                                         likelihoodRatioMatrix, repeatProb,
+                                         repeatEndProb, repeatOffsetProbDecay,
+                                         firstGapProb, otherGapProb,
+                                         probabilities);
+}
+
+void getProbabilitiesBidirectionally(const uchar *seqBeg,
+                                     const uchar *seqEnd,
+                                     int maxRepeatOffset,
+                                     const const_double_ptr
+                                     *likelihoodRatioMatrix,
+                                     double repeatProb,
+                                     double repeatEndProb,
+                                     double repeatOffsetProbDecay,
+                                     double firstGapProb,
+                                     double otherGapProb,
+                                     float *probabilities) {
+  backend()->getProbabilitiesBidirectionally(seqBeg, seqEnd, maxRepeatOffset,
+                                             likelihoodRatioMatrix,
+                                             repeatProb, repeatEndProb,
+                                             repeatOffsetProbDecay,
+                                             firstGapProb, otherGapProb,
+                                             probabilities);
+}
+
+void getProbabilitiesInWindows(const uchar *seqBeg,
+                               const uchar *seqEnd,
+                               int maxRepeatOffset,
+                               const const_double_ptr *likelihoodRatioMatrix,
+                               double repeatProb,
+                               double repeatEndProb,
+                               double repeatOffsetProbDecay,
+                               double firstGapProb,
+                               double otherGapProb,
+                               float *probabilities,
+                               size_t windowLength,
+                               size_t windowOverlap,
+                               int numOfThreads) {
+  backend()->getProbabilitiesInWindows(seqBeg, seqEnd, maxRepeatOffset,
+                                       likelihoodRatioMatrix, repeatProb,
+                                       repeatEndProb, repeatOffsetProbDecay,
+                                       firstGapProb, otherGapProb,
+                                       probabilities, windowLength,
+                                       windowOverlap, numOfThreads);
+}
+
+void getProbabilitiesInChunks(const uchar *seqBeg,
+                              const uchar *seqEnd,
+                              int maxRepeatOffset,
+                              const const_double_ptr *likelihoodRatioMatrix,
+                              double repeatProb,
+                              double repeatEndProb,
+                              double repeatOffsetProbDecay,
+                              double firstGapProb,
+                              double otherGapProb,
+                              float *probabilities,
+                              size_t chunkLength,
+                              int numOfThreads) {
+  backend()->getProbabilitiesInChunks(seqBeg, seqEnd, maxRepeatOffset,
+                                      likelihoodRatioMatrix, repeatProb,
+                                      repeatEndProb, repeatOffsetProbDecay,
+                                      firstGapProb, otherGapProb,
+                                      probabilities, chunkLength,
+                                      numOfThreads);
+}
+
+void getProbabilitiesWithLookahead(const uchar *contextBeg,
+                                   const uchar *seqBeg,
+                                   const uchar *seqMid,
+                                   const uchar *seqEnd,
+                                   int maxRepeatOffset,
+                                   const const_double_ptr
+                                   *likelihoodRatioMatrix,
+                                   double repeatProb,
+                                   double repeatEndProb,
+                                   double repeatOffsetProbDecay,
+                                   double firstGapProb,
+                                   double otherGapProb,
+                                   double *forwardState,
+                                   float *probabilities) {
+  backend()->getProbabilitiesWithLookahead(contextBeg, seqBeg, seqMid,
+                                           seqEnd, maxRepeatOffset,
+                                           likelihoodRatioMatrix,
+                                           repeatProb, repeatEndProb,
+                                           repeatOffsetProbDecay,
+                                           firstGapProb, otherGapProb,
+                                           forwardState, probabilities);
+}
+
+size_t defaultWindowOverlap(int maxRepeatOffset, double repeatEndProb) {
+  return backend()->defaultWindowOverlap(maxRepeatOffset, repeatEndProb);
+}
+
+void maskProbableLetters(uchar *seqBeg,
+                         uchar *seqEnd,
+                         const float *probabilities,
+                         double minMaskProb,
+                         const uchar *maskTable) {
+  backend()->maskProbableLetters(seqBeg, seqEnd, probabilities,
+                                 minMaskProb, maskTable);
+}
+
+const float *findProbable(const float *beg, const float *end,
+                          double minMaskProb) {
+  return backend()->findProbable(beg, end, minMaskProb);
+}
+
+const float *findImprobable(const float *beg, const float *end,
+                            double minMaskProb) {
+  return backend()->findImprobable(beg, end, minMaskProb);
+}
+
+uchar *transformLetters(uchar *beg, uchar *end, const uchar *table) {
+  return backend()->transformLetters(beg, end, table);
+}
+
+void countTransitions(const uchar *seqBeg,
+                      const uchar *seqEnd,
+                      int maxRepeatOffset,
+                      const const_double_ptr *likelihoodRatioMatrix,
+                      double repeatProb,
+                      double repeatEndProb,
+                      double repeatOffsetProbDecay,
+                      double firstGapProb,
+                      double otherGapProb,
+                      double *transitionCounts) {
+  backend()->countTransitions(seqBeg, seqEnd, maxRepeatOffset,
+                              likelihoodRatioMatrix, repeatProb,
+                              repeatEndProb, repeatOffsetProbDecay,
+                              firstGapProb, otherGapProb, transitionCounts);
+}
+
+void calcRepeatFinderScores(const RepeatFinderModel &model,
+			    const uchar *seqBeg, const uchar *seqPtr,
+			    const double *oldScores, double *scores) {
+  backend()->calcRepeatFinderScores(model, seqBeg, seqPtr, oldScores, scores);
+}
+
+void calcRepeatFinderIntScores(const RepeatFinderModel &model,
+			       const uchar *seqBeg, const uchar *seqPtr,
+			       const short *oldScores, short *scores) {
+  backend()->calcRepeatFinderIntScores(model, seqBeg, seqPtr,
+				       oldScores, scores);
+}
+
+}
@@ -0,0 +1,48 @@
+// Copyright 2026 Martin C. Frith
+
+// tantan.cc is compiled several times, for different SIMD instruction
+// sets, each time in a different namespace (TANTAN_SIMD).  Each
+// compilation defines a SimdBackend, and tantan_simd.cc forwards the
+// functions in tantan.hh to the best one for this CPU.
+
+#ifndef TANTAN_SIMD_HH
+#define TANTAN_SIMD_HH
+
+#include "tantan.hh"
+#include "tantan_repeat_finder.hh"
+
+namespace tantan {
+
+struct SimdBackend {
+  const char *name;
+  decltype(&tantan::maskSequences) maskSequences;
+  decltype(&tantan::maskSequencesWithCheckpoints)
+  maskSequencesWithCheckpoints;
+  decltype(&tantan::getProbabilities) getProbabilities;
+  decltype(&tantan::getProbabilitiesOfSequences) getProbabilitiesOfSequences;
+  decltype(&tantan::getProbabilitiesBidirectionally)
+  getProbabilitiesBidirectionally;
+  decltype(&tantan::getProbabilitiesInWindows) getProbabilitiesInWindows;
+  decltype(&tantan::getProbabilitiesInChunks) getProbabilitiesInChunks;
+  decltype(&tantan::getProbabilitiesWithLookahead)
+  getProbabilitiesWithLookahead;
+  decltype(&tantan::defaultWindowOverlap) defaultWindowOverlap;
+  decltype(&tantan::maskProbableLetters) maskProbableLetters;
+  decltype(&tantan::findProbable) findProbable;
+  decltype(&tantan::findImprobable) findImprobable;
+  decltype(&tantan::transformLetters) transformLetters;
+  decltype(&tantan::countTransitions) countTransitions;
+  decltype(&tantan::calcRepeatFinderScores) calcRepeatFinderScores;
+  decltype(&tantan::calcRepeatFinderIntScores) calcRepeatFinderIntScores;
+  decltype(&tantan::setSinglePrecision) setSinglePrecision;
+};
+
+namespace scalar { extern const SimdBackend backend; }
+namespace sse4 { extern const SimdBackend backend; }
+namespace avx2 { extern const SimdBackend backend; }
+namespace avx512 { extern const SimdBackend backend; }
+namespace native { extern const SimdBackend backend; }
+
+}
+
+#endif
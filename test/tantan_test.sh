@@ -11,6 +11,22 @@ countLowercaseLetters () {
     grep -v '^>' "$@" | tr -cd a-z | wc -c | tr -d ' '
 }
 
+tmp=${TMPDIR-/tmp}/tantan_test.$$
+mkdir $tmp || exit 1
+trap 'rm -rf $tmp' EXIT
+
+# Check that 2 commands give byte-identical output:
+sameOutput () {
+    eval "$1" > $tmp/out1 2>&1
+    eval "$2" > $tmp/out2 2>&1
+    cmp -s $tmp/out1 $tmp/out2 && echo same || echo "differ: $1 / $2"
+}
+
+# The AVX2 engine (which the default picks only if the CPU lacks
+# AVX-512), or the default if the CPU lacks AVX2:
+avx2=avx2
+tantan --simd=avx2 --version > /dev/null 2>&1 || avx2=auto
+
 {
     tantan hg19_chrM.fa
     echo
@@ -39,4 +55,114 @@ countLowercaseLetters () {
     tantan -f4 -b0 panda.fastq
     echo
     tantan -f4 -b0 -j0 panda.fastq
+    echo
+    tantan -t3 -f3 panda.fastq
+    echo
+    tantan -t2 --window=1000 hg19_chrM.fa | countLowercaseLetters
+    echo
+    tantan -p -t3 --window=5000 --exact -f3 titin_human.fa
+    echo
+    tantan --bidirectional hg19_chrM.fa | countLowercaseLetters
+    echo
+    tantan -t2 -f4 panda.fastq
+    echo
+    sameOutput "tantan -t3 hg19_chrM.fa panda.fastq hard.fa" \
+	"tantan hg19_chrM.fa panda.fastq hard.fa"
+    echo
+    sameOutput "tantan --float hg19_chrM.fa" "tantan hg19_chrM.fa"
+    echo
+    sameOutput "tantan --float -p -f3 titin_human.fa" \
+	"tantan -p -f3 titin_human.fa"
+    echo
+    sameOutput "tantan --simd=$avx2 hg19_chrM.fa" \
+	"tantan --simd=scalar hg19_chrM.fa"
+    echo
+    sameOutput "tantan --simd=$avx2 -f2 hg19_chrM.fa" \
+	"tantan --simd=scalar -f2 hg19_chrM.fa"
+    echo
+    sameOutput "tantan --simd=$avx2 -p -f3 titin_human.fa" \
+	"tantan --simd=scalar -p -f3 titin_human.fa"
+    echo
+    sameOutput "tantan -f4 --int16 hg19_chrM.fa" "tantan -f4 hg19_chrM.fa"
+    echo
+    sameOutput "tantan -f4 --int16 panda.fastq" "tantan -f4 panda.fastq"
+    echo
+    sameOutput "tantan -f4 --int16 -b12 hard.fa" "tantan -f4 -b12 hard.fa"
+    echo
+    printf '>empty\n\n>one\nA\n>two\nac\n' > $tmp/short.fa
+    sameOutput "tantan --checkpoints $tmp/short.fa" "tantan $tmp/short.fa"
+    echo
+    sameOutput "tantan --checkpoints hg19_chrM.fa" "tantan hg19_chrM.fa"
+    echo
+    sameOutput "tantan --lag=300 hg19_chrM.fa hard.fa" \
+	"tantan hg19_chrM.fa hard.fa"
+    echo
+    sameOutput "tantan --lag=50 -f3 hg19_chrM.fa hard.fa" \
+	"tantan -f3 hg19_chrM.fa hard.fa"
+    echo
+    tantan --lag=300 panda.fastq
+    echo
+    cp hg19_chrM.fa panda.fastq $tmp
+    sameOutput "tantan --mmap $tmp/hg19_chrM.fa $tmp/panda.fastq" \
+	"tantan hg19_chrM.fa panda.fastq"
+    echo
+    sameOutput "tantan --mmap -f3 $tmp/hg19_chrM.fa" "tantan -f3 hg19_chrM.fa"
+    echo
+    gzip -c hg19_chrM.fa > $tmp/chrM.fa.gz
+    sameOutput "tantan --mmap $tmp/chrM.fa.gz" "tantan hg19_chrM.fa"
+    echo
+    # CRLF, with 67 and 13 letters per line: --mmap keeps the line layout
+    grep -v '>' hg19_chrM.fa | tr -d '\n' > $tmp/chrM.txt
+    { echo ">a"; head -c 9000 $tmp/chrM.txt | fold -w 67; echo
+	echo ">b"; tail -c 5000 $tmp/chrM.txt | fold -w 13; echo
+    } | sed 's/$/\r/' > $tmp/crlf.fa
+    sameOutput "tantan --mmap $tmp/crlf.fa | tr a-z A-Z" \
+	"tr a-z A-Z < $tmp/crlf.fa"
+    echo
+    sameOutput "tantan --mmap $tmp/crlf.fa | tr -d '\r\n'" \
+	"tantan $tmp/crlf.fa | tr -d '\r\n'"
+    echo
+    cp hg19_chrM_bgzf.fa.gz $tmp/isize.gz  # give the last block a huge size
+    size=$(wc -c < $tmp/isize.gz)
+    printf '\377\377\377\377' |
+	dd of=$tmp/isize.gz bs=1 seek=$((size - 4)) conv=notrunc 2> /dev/null
+    tantan $tmp/isize.gz > /dev/null
+    echo
+    head -c 3000 hg19_chrM_bgzf.fa.gz > $tmp/cut.gz
+    tantan $tmp/cut.gz > /dev/null
+    echo
+    gzip -c hg19_chrM.fa | head -c 3000 > $tmp/cut.gz
+    tantan $tmp/cut.gz > /dev/null
+    echo
+    sameOutput "tantan -t3 hg19_chrM_bgzf.fa.gz" "tantan hg19_chrM.fa"
+    echo
+    sameOutput "tantan -t3 $tmp/chrM.fa.gz" "tantan hg19_chrM.fa"
+    echo
+    cp hg19_chrM_bgzf.fa.gz $tmp/bad.gz  # corrupt the 2nd block's data
+    printf junk | dd of=$tmp/bad.gz bs=1 seek=2000 conv=notrunc 2> /dev/null
+    tantan -t3 $tmp/bad.gz > /dev/null
+    echo
+    tantan --window=-1 hard.fa
+    echo
+    tantan --lag=-1 hard.fa
+    echo
+    # Reads of uneven lengths, done together in SIMD lanes, or one by one:
+    n=0
+    for len in 0 1 37 500 0 2000 9999 10001 123
+    do
+	n=$((n + 1))
+	{ echo ">r$n"; tail -c +$((n * 701)) $tmp/chrM.txt | head -c $len
+	    echo; } > $tmp/read$n.fa
+    done
+    cat $tmp/read?.fa > $tmp/reads.fa
+    sameOutput "tantan $tmp/reads.fa" \
+	"for i in 1 2 3 4 5 6 7 8 9; do tantan $tmp/read\$i.fa; done"
+    echo
+    sameOutput "tantan -f1 $tmp/reads.fa" "tantan --lag=20000 -f1 $tmp/reads.fa"
+    echo
+    # A long exact repeat with period 7, where --exact gives up:
+    { echo ">sat7"; yes ACGTTGA | head -n 3000 | tr -d '\n'; echo
+    } > $tmp/sat7.fa
+    sameOutput "tantan -t2 -f1 --window=10000 --exact $tmp/sat7.fa" \
+	"tantan -f1 $tmp/sat7.fa"
 } 2>&1 | diff -u tantan_test.out -